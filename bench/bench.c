@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "bench.h"
+
+/* ---------------------------------------------------------------------------
+ * Shared timing and json lines output for the benchmarks.
+ */
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+static FILE *g_out;
+static int   g_first;
+
+void bench_init(int argc, char *argv[])
+{
+    int fd;
+
+    (void)argc;
+    (void)argv;
+    fflush(stdout);
+    g_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!g_out) g_out = stderr;
+    if (!getenv("BENCH_VERBOSE") && (fd = open("/dev/null", O_WRONLY)) >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+}
+
+int64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double bench_seconds(void)
+{
+    const char *s = getenv("BENCH_SECONDS");
+    double sec = s ? atof(s) : 0;
+    return sec > 0 ? sec : 2;
+}
+
+void bench_begin(const char *name)
+{
+    fprintf(g_out, "{");
+    g_first = 1;
+    bench_str("bench", name);
+    bench_str("rev"  , BENCH_REV);
+}
+
+static void
+bench_key(const char *key)
+{
+    fprintf(g_out, "%s\"%s\":", g_first ? "" : ",", key);
+    g_first = 0;
+}
+
+void bench_str(const char *key, const char *val)
+{
+    bench_key(key);
+    fputc('"', g_out);
+    for (; *val; val++) {
+        if (*val == '"' || *val == '\\') fputc('\\', g_out);
+        if ((unsigned char)*val >= 0x20) fputc(*val, g_out);
+    }
+    fputc('"', g_out);
+}
+
+void bench_int(const char *key, int64_t val)
+{
+    bench_key(key);
+    fprintf(g_out, "%lld", (long long)val);
+}
+
+void bench_num(const char *key, double val)
+{
+    bench_key(key);
+    fprintf(g_out, "%.3f", val);
+}
+
+void bench_fourcc(const char *key, unsigned int fcc)
+{
+    char s[5] = { fcc, fcc >> 8, fcc >> 16, fcc >> 24, 0 };
+    bench_str(key, s);
+}
+
+void bench_end(void)
+{
+    fprintf(g_out, "}\n");
+    fflush(g_out);
+}
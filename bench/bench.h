@@ -0,0 +1,19 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+
+// every result is one json object per line on the original stdout, the library's
+// own printf output goes to /dev/null unless BENCH_VERBOSE is set
+void    bench_init(int argc, char *argv[]);
+int64_t bench_ns  (void);
+double  bench_seconds(void); // how long a timed case runs, BENCH_SECONDS, default 2
+
+void    bench_begin (const char *name);
+void    bench_str   (const char *key, const char *val);
+void    bench_int   (const char *key, int64_t val);
+void    bench_num   (const char *key, double  val);
+void    bench_fourcc(const char *key, unsigned int fcc);
+void    bench_end   (void);
+
+#endif
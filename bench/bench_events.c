@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/usb/ch9.h>
+#include <linux/videodev2.h>
+#include "linux/video.h"
+#include "linux/uvc.h"
+#include "camuvc.h"
+#include "bench.h"
+#include "mock_gadget.h"
+
+/* ---------------------------------------------------------------------------
+ * Control requests answered per second, once through camuvc_dispatch() in
+ * the caller's loop and once through the library's own event thread.
+ */
+
+#define BATCH 64
+
+static int
+bench_case(int flags, double seconds)
+{
+    int64_t t0, t1 = 0, n = 0;
+    int     i;
+    void   *ctx;
+
+    mock_gadget_reset();
+    ctx = camuvc_init_ex(MOCK_GADGET_PATH, flags);
+    if (!ctx) return -1;
+
+    t0 = bench_ns();
+    do {
+        // alternate interfaces so both the control and streaming handlers are hit
+        for (i=0; i<BATCH; i++, n++) {
+            mock_post_setup(i & 1 ? UVC_GET_INFO : UVC_GET_LEN, i & 1 ? UVC_VS_PROBE_CONTROL : 1, i & 2 ? UVC_INTF_STREAMING : UVC_INTF_CONTROL, 2);
+        }
+        if (flags & CAMUVC_INIT_NOTHREAD) {
+            while (mock_events_pending()) camuvc_dispatch(ctx, BATCH);
+        } else {
+            mock_wait_responses(n, seconds * 1000);
+        }
+        t1 = bench_ns();
+    } while (t1 - t0 < seconds * 1000000000.0);
+    n = mock_responses();
+
+    bench_begin("events");
+    bench_str("mode", flags & CAMUVC_INIT_NOTHREAD ? "dispatch" : "thread");
+    bench_int("events", n);
+    bench_num("ns_per_event", (double)(t1 - t0) / n);
+    bench_num("events_per_s", n * 1e9 / (t1 - t0));
+    bench_end();
+
+    camuvc_exit(ctx);
+    return n ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_init(argc, argv);
+    if (bench_case(CAMUVC_INIT_NOTHREAD, bench_seconds() / 2) < 0 || bench_case(CAMUVC_INIT_LAZY, bench_seconds() / 2) < 0) {
+        fprintf(stderr, "events failed\n");
+        return 1;
+    }
+    return 0;
+}
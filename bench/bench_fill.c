@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <linux/videodev2.h>
+#include "camuvc.h"
+#include "bench.h"
+#include "mock_gadget.h"
+
+/* ---------------------------------------------------------------------------
+ * Fill path cost per format and size, frames are pushed and dispatched
+ * without threads so the time is what building one gadget buffer takes.
+ */
+
+// bFormatIndex / bFrameIndex as in the library's format table
+static const struct {
+    int iformat;
+    int iframe;
+} g_cases[] = {
+    { 1, 1 }, { 1, 2 }, { 1, 3 }, // NV12 copy
+    { 5, 1 }, { 5, 2 }, { 5, 3 }, // YUY2 packed from NV12
+    { 2, 1 }, { 2, 2 }, { 2, 3 }, // MJPEG encoded from NV12
+    { 3, 1 }, { 3, 2 }, { 3, 3 }, // H.264 gathered from pieces
+};
+
+#define PIECES 8
+
+static void
+bench_picture(uint8_t *data, int width, int height)
+{
+    int x, y;
+    for (y=0; y<height; y++) {
+        for (x=0; x<width; x++) data[y * width + x] = (x + y) & 0xff;
+    }
+    memset(data + width * height, 0x80, width * height / 2);
+}
+
+// one annex-b access unit, parameter sets and an idr slice spread over PIECES iovecs
+static int
+bench_access_unit(uint8_t *data, int size, struct iovec *iov)
+{
+    static const uint8_t sps[] = { 0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe8 };
+    static const uint8_t pps[] = { 0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80 };
+    int i, n = sizeof(sps) + sizeof(pps);
+
+    memcpy(data, sps, sizeof(sps));
+    memcpy(data + sizeof(sps), pps, sizeof(pps));
+    data[n + 0] = 0; data[n + 1] = 0; data[n + 2] = 1; data[n + 3] = 0x65;
+    for (i=n+4; i<size; i++) data[i] = (i * 7) | 1; // no start codes in the payload
+    for (i=0; i<PIECES; i++) {
+        iov[i].iov_base = data + (int64_t)size * i / PIECES;
+        iov[i].iov_len  = (int64_t)size * (i + 1) / PIECES - (int64_t)size * i / PIECES;
+    }
+    return size;
+}
+
+static int
+bench_case(int iformat, int iframe, double seconds)
+{
+    struct camuvc_frame frame;
+    struct iovec iov[PIECES];
+    unsigned int fcc;
+    uint8_t *data;
+    int64_t  t0, t1, n0, n, b0;
+    int      width, height, size;
+    void    *ctx;
+
+    mock_gadget_reset();
+    ctx = camuvc_init_ex(MOCK_GADGET_PATH, CAMUVC_INIT_NOTHREAD);
+    if (!ctx || camuvc_producer_open(ctx, 4) < 0) {
+        camuvc_exit(ctx);
+        return -1;
+    }
+    mock_post_stream(iformat, iframe);
+    while (mock_events_pending()) camuvc_dispatch(ctx, 16);
+    mock_format(&fcc, &width, &height);
+
+    data = malloc(width * height * 2);
+    memset(&frame, 0, sizeof(frame));
+    if (fcc == v4l2_fourcc('H','2','6','4')) {
+        // a typical intra frame, well below the buffer size
+        size = bench_access_unit(data, width * height * 3 / 2 / 10, iov);
+        frame.iov    = iov;
+        frame.iovcnt = PIECES;
+    } else {
+        bench_picture(data, width, height);
+        size         = width * height * 3 / 2;
+        frame.data   = data;
+        frame.len    = size;
+        frame.fcc    = V4L2_PIX_FMT_NV12;
+        frame.width  = width;
+        frame.height = height;
+        frame.uoff   = width * height;
+    }
+
+    // warm up the buffers and the pool before timing
+    while (mock_frames() < 8) {
+        camuvc_push(ctx, &frame, NULL, NULL, 0);
+        camuvc_dispatch(ctx, 16);
+    }
+    n0 = mock_frames();
+    b0 = mock_bytes();
+    t0 = bench_ns();
+    do {
+        camuvc_push(ctx, &frame, NULL, NULL, 0);
+        camuvc_dispatch(ctx, 16);
+        t1 = bench_ns();
+    } while (t1 - t0 < seconds * 1000000000.0);
+    n = mock_frames() - n0;
+
+    bench_begin("fill");
+    bench_fourcc("format", fcc);
+    bench_int("width" , width );
+    bench_int("height", height);
+    bench_int("frames", n);
+    bench_int("input_bytes", size);
+    bench_int("output_bytes", n ? (mock_bytes() - b0) / n : 0);
+    bench_num("ns_per_frame", n ? (double)(t1 - t0) / n : 0);
+    bench_num("fps", n * 1e9 / (t1 - t0));
+    bench_num("mb_per_s", (double)(mock_bytes() - b0) * 1000 / (t1 - t0));
+    bench_end();
+
+    camuvc_exit(ctx);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+
+    bench_init(argc, argv);
+    for (i=0; i<sizeof(g_cases)/sizeof(g_cases[0]); i++) {
+        if (bench_case(g_cases[i].iformat, g_cases[i].iframe, bench_seconds() / 4) < 0) {
+            fprintf(stderr, "fill case %d/%d failed\n", g_cases[i].iformat, g_cases[i].iframe);
+            return 1;
+        }
+    }
+    return 0;
+}
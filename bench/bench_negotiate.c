@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/usb/ch9.h>
+#include <linux/videodev2.h>
+#include "linux/video.h"
+#include "linux/uvc.h"
+#include "camuvc.h"
+#include "bench.h"
+#include "mock_gadget.h"
+
+/* ---------------------------------------------------------------------------
+ * Probe and commit rounds as a host runs them, SET_CUR, the data stage that
+ * ends up in uvc_events_process_data() and a GET_CUR to read the result back.
+ */
+
+static const struct {
+    const char *name;
+    int         cs;
+    int         iformat;
+} g_cases[] = {
+    { "probe" , UVC_VS_PROBE_CONTROL , 1 },
+    { "probe" , UVC_VS_PROBE_CONTROL , 2 },
+    { "probe" , UVC_VS_PROBE_CONTROL , 3 },
+    { "commit", UVC_VS_COMMIT_CONTROL, 1 },
+    { "commit", UVC_VS_COMMIT_CONTROL, 2 },
+    { "commit", UVC_VS_COMMIT_CONTROL, 3 },
+};
+
+static int
+bench_case(const char *name, int cs, int iformat, double seconds)
+{
+    struct uvc_streaming_control ctrl;
+    int64_t t0, t1, n;
+    void   *ctx;
+
+    mock_gadget_reset();
+    ctx = camuvc_init_ex(MOCK_GADGET_PATH, CAMUVC_INIT_NOTHREAD);
+    if (!ctx) return -1;
+
+    t0 = bench_ns();
+    for (n=0; ; n++) {
+        // walk the frame sizes so that every round really changes the result
+        memset(&ctrl, 0, sizeof(ctrl));
+        ctrl.bmHint          = 1;
+        ctrl.bFormatIndex    = iformat;
+        ctrl.bFrameIndex     = 1 + n % 3;
+        ctrl.dwFrameInterval = 1000000000 / 15 / 100;
+        mock_post_setup(UVC_SET_CUR, cs, UVC_INTF_STREAMING, sizeof(ctrl));
+        mock_post_data (&ctrl, sizeof(ctrl));
+        mock_post_setup(UVC_GET_CUR, cs, UVC_INTF_STREAMING, sizeof(ctrl));
+        while (mock_events_pending()) camuvc_dispatch(ctx, 4);
+        if (((t1 = bench_ns()) - t0) >= seconds * 1000000000.0) break;
+    }
+    n++;
+
+    bench_begin("negotiate");
+    bench_str("control", name);
+    bench_int("format_index", iformat);
+    bench_int("rounds", n);
+    bench_int("responses", mock_responses());
+    bench_num("ns_per_round", (double)(t1 - t0) / n);
+    bench_num("rounds_per_s", n * 1e9 / (t1 - t0));
+    bench_end();
+
+    camuvc_exit(ctx);
+    return mock_responses() == (uint64_t)n * 2 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+
+    bench_init(argc, argv);
+    for (i=0; i<sizeof(g_cases)/sizeof(g_cases[0]); i++) {
+        if (bench_case(g_cases[i].name, g_cases[i].cs, g_cases[i].iformat, bench_seconds() / 4) < 0) {
+            fprintf(stderr, "negotiate %s %d failed\n", g_cases[i].name, g_cases[i].iformat);
+            return 1;
+        }
+    }
+    return 0;
+}
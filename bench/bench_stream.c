@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include "camuvc.h"
+#include "bench.h"
+#include "mock_gadget.h"
+
+/* ---------------------------------------------------------------------------
+ * End to end frames per second with the library's own threads, the built-in
+ * pattern as the source and a host that drains every buffer at once, the
+ * frame counter in the pattern shows frames that were skipped or sent twice.
+ */
+
+static const struct {
+    int iformat;
+    int iframe;
+} g_cases[] = {
+    { 1, 2 }, // NV12 640x480
+    { 1, 3 }, // NV12 1280x720
+    { 5, 3 }, // YUY2 1280x720
+    { 2, 3 }, // MJPEG 1920x1080
+};
+
+struct bench_host {
+    unsigned int fcc;
+    int          width;
+    int          height;
+    int64_t      last;
+    int64_t      skipped;
+    int64_t      repeated;
+};
+
+static void
+bench_consume(void *opaque, const uint8_t *data, int len)
+{
+    struct bench_host *host = opaque;
+    int64_t cnt;
+
+    (void)len;
+    if ((cnt = camuvc_pattern_counter(data, host->fcc, host->width, host->height)) < 0) return;
+    if (host->last >= 0 && cnt <= host->last) host->repeated++;
+    if (host->last >= 0 && cnt >  host->last + 1) host->skipped += cnt - host->last - 1;
+    host->last = cnt;
+}
+
+static int
+bench_case(int iformat, int iframe, double seconds)
+{
+    struct bench_host host;
+    int64_t t0, t1, n0, b0;
+    void   *ctx;
+
+    mock_gadget_reset();
+    ctx = camuvc_init_ex(MOCK_GADGET_PATH, 0);
+    if (!ctx || camuvc_pattern(ctx, CAMUVC_PATTERN_BARS | CAMUVC_PATTERN_COUNTER | CAMUVC_PATTERN_FAST) < 0) {
+        camuvc_exit(ctx);
+        return -1;
+    }
+    mock_post_stream(iformat, iframe);
+    if (mock_wait_frames(8, 5000) < 0) {
+        camuvc_exit(ctx);
+        return -1;
+    }
+    memset(&host, 0, sizeof(host));
+    host.last = -1;
+    mock_format(&host.fcc, &host.width, &host.height);
+    mock_gadget_consume(bench_consume, &host);
+
+    n0 = mock_frames();
+    b0 = mock_bytes();
+    t0 = bench_ns();
+    mock_wait_frames((uint64_t)-1, seconds * 1000);
+    t1 = bench_ns();
+    mock_gadget_consume(NULL, NULL);
+
+    bench_begin("stream");
+    bench_fourcc("format", host.fcc);
+    bench_int("width" , host.width );
+    bench_int("height", host.height);
+    bench_int("frames", mock_frames() - n0);
+    bench_num("fps", (mock_frames() - n0) * 1e9 / (t1 - t0));
+    bench_num("mb_per_s", (double)(mock_bytes() - b0) * 1000 / (t1 - t0));
+    if (host.last >= 0) {
+        bench_int("skipped" , host.skipped );
+        bench_int("repeated", host.repeated);
+    }
+    bench_end();
+
+    camuvc_exit(ctx);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+
+    bench_init(argc, argv);
+    for (i=0; i<sizeof(g_cases)/sizeof(g_cases[0]); i++) {
+        if (bench_case(g_cases[i].iformat, g_cases[i].iframe, bench_seconds() / 2) < 0) {
+            fprintf(stderr, "stream case %d/%d failed\n", g_cases[i].iformat, g_cases[i].iframe);
+            return 1;
+        }
+    }
+    return 0;
+}
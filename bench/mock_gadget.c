@@ -0,0 +1,456 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <linux/usb/ch9.h>
+#include <linux/videodev2.h>
+#include "linux/video.h"
+#include "linux/uvc.h"
+#include "mock_gadget.h"
+
+/* ---------------------------------------------------------------------------
+ * Mock uvc gadget. One node, events are queued by the bench and buffers are
+ * plain heap memory handed out through mmap. A poll on the node together with
+ * real descriptors sleeps on those and a wakeup eventfd poked on every change.
+ */
+
+#define MOCK_MAX_EVENTS 256
+#define MOCK_MAX_BUFS   8
+
+int   __real_open  (const char *path, int flags, ...);
+int   __real_close (int fd);
+int   __real_ioctl (int fd, unsigned long req, ...);
+void* __real_mmap  (void *addr, size_t len, int prot, int flags, int fd, off_t off);
+int   __real_munmap(void *addr, size_t len);
+int   __real_select(int nfds, fd_set *r, fd_set *w, fd_set *e, struct timeval *tv);
+int   __real_poll  (struct pollfd *fds, nfds_t nfds, int timeout);
+
+static struct {
+    pthread_mutex_t    mutex;
+    pthread_cond_t     cond;
+    int                fd;
+    int                wake;
+    struct v4l2_event  events[MOCK_MAX_EVENTS];
+    int                ehead;
+    int                ecount;
+    uint64_t           nresp;
+    struct v4l2_format fmt;
+    uint8_t           *bufs[MOCK_MAX_BUFS]; // kept for the process, munmap may come after close
+    unsigned int       bufcap[MOCK_MAX_BUFS];
+    unsigned int       nbufs;
+    unsigned int       bufsize;
+    unsigned int       done[MOCK_MAX_BUFS]; // drained, waiting for DQBUF
+    unsigned int       ndone;
+    unsigned int       pending[MOCK_MAX_BUFS]; // queued before STREAMON
+    unsigned int       npending;
+    int                streaming;
+    uint64_t           frames;
+    uint64_t           bytes;
+    void             (*consume)(void *opaque, const uint8_t *data, int len);
+    void              *opaque;
+} g_mock = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, -1, -1 };
+
+static void
+mock_deadline(struct timespec *ts, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += ms % 1000 * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) { ts->tv_nsec -= 1000000000L; ts->tv_sec++; }
+}
+
+// the node changed, called with the mutex held
+static void
+mock_signal(void)
+{
+    uint64_t cnt = 1;
+    pthread_cond_broadcast(&g_mock.cond);
+    if (g_mock.wake >= 0 && write(g_mock.wake, &cnt, sizeof(cnt)) < 0) {}
+}
+
+// the host takes the buffer, called with the mutex held
+static void
+mock_drain(unsigned int index, int bytesused)
+{
+    if (g_mock.consume) g_mock.consume(g_mock.opaque, g_mock.bufs[index], bytesused);
+    g_mock.frames++;
+    g_mock.bytes += bytesused;
+    g_mock.done[g_mock.ndone++] = index;
+    mock_signal();
+}
+
+static void
+mock_free_bufs(void)
+{
+    g_mock.nbufs    = 0;
+    g_mock.ndone    = 0;
+    g_mock.npending = 0;
+}
+
+static int
+mock_ioctl(unsigned long req, void *arg)
+{
+    struct v4l2_requestbuffers *rb;
+    struct v4l2_buffer         *buf;
+    struct v4l2_capability     *cap;
+    unsigned int i;
+
+    switch (req) {
+    case VIDIOC_QUERYCAP:
+        cap = arg;
+        memset(cap, 0, sizeof(*cap));
+        snprintf((char*)cap->card, sizeof(cap->card), "mock gadget");
+        snprintf((char*)cap->bus_info, sizeof(cap->bus_info), "bench");
+        return 0;
+    case VIDIOC_SUBSCRIBE_EVENT:
+        return 0;
+    case VIDIOC_DQEVENT:
+        if (!g_mock.ecount) { errno = ENOENT; return -1; }
+        memcpy(arg, &g_mock.events[g_mock.ehead], sizeof(struct v4l2_event));
+        g_mock.ehead = (g_mock.ehead + 1) % MOCK_MAX_EVENTS;
+        g_mock.ecount--;
+        pthread_cond_broadcast(&g_mock.cond);
+        return 0;
+    case UVCIOC_SEND_RESPONSE:
+        g_mock.nresp++;
+        pthread_cond_broadcast(&g_mock.cond);
+        return 0;
+    case VIDIOC_G_FMT:
+        memcpy(arg, &g_mock.fmt, sizeof(g_mock.fmt));
+        return 0;
+    case VIDIOC_S_FMT:
+        memcpy(&g_mock.fmt, arg, sizeof(g_mock.fmt));
+        return 0;
+    case VIDIOC_REQBUFS:
+        rb = arg;
+        mock_free_bufs();
+        if (rb->count > MOCK_MAX_BUFS) rb->count = MOCK_MAX_BUFS;
+        g_mock.bufsize = (g_mock.fmt.fmt.pix.sizeimage + 4095) & ~4095;
+        for (i=0; i<rb->count; i++) {
+            if (g_mock.bufcap[i] >= g_mock.bufsize) continue;
+            free(g_mock.bufs[i]);
+            g_mock.bufcap[i] = (g_mock.bufs[i] = malloc(g_mock.bufsize)) ? g_mock.bufsize : 0;
+            if (!g_mock.bufs[i]) break;
+        }
+        rb->count = g_mock.nbufs = i;
+        return 0;
+    case VIDIOC_QUERYBUF:
+        buf = arg;
+        if (buf->index >= g_mock.nbufs) { errno = EINVAL; return -1; }
+        buf->length   = g_mock.bufsize;
+        buf->m.offset = buf->index * 4096;
+        return 0;
+    case VIDIOC_QBUF:
+        buf = arg;
+        if (buf->index >= g_mock.nbufs) { errno = EINVAL; return -1; }
+        if (g_mock.streaming) mock_drain(buf->index, buf->bytesused);
+        else g_mock.pending[g_mock.npending++] = buf->index;
+        return 0;
+    case VIDIOC_DQBUF:
+        buf = arg;
+        if (!g_mock.ndone) { errno = EAGAIN; return -1; }
+        buf->index = g_mock.done[0];
+        memmove(g_mock.done, g_mock.done + 1, --g_mock.ndone * sizeof(g_mock.done[0]));
+        return 0;
+    case VIDIOC_STREAMON:
+        g_mock.streaming = 1;
+        for (i=0; i<g_mock.npending; i++) mock_drain(g_mock.pending[i], g_mock.fmt.fmt.pix.sizeimage);
+        g_mock.npending = 0;
+        return 0;
+    case VIDIOC_STREAMOFF:
+        g_mock.streaming = 0;
+        g_mock.ndone     = 0;
+        g_mock.npending  = 0;
+        return 0;
+    }
+    return 0;
+}
+
+int __wrap_open(const char *path, int flags, ...)
+{
+    va_list ap;
+    int     mode = 0;
+
+    if (strcmp(path, MOCK_GADGET_PATH) != 0) {
+        if (flags & O_CREAT) {
+            va_start(ap, flags);
+            mode = va_arg(ap, int);
+            va_end(ap);
+        }
+        return __real_open(path, flags, mode);
+    }
+    // a real descriptor so the number cannot clash with anything else
+    pthread_mutex_lock(&g_mock.mutex);
+    if (g_mock.fd < 0) g_mock.fd = __real_open("/dev/null", O_RDWR);
+    if (g_mock.wake < 0) g_mock.wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pthread_mutex_unlock(&g_mock.mutex);
+    return g_mock.fd;
+}
+
+int __wrap_close(int fd)
+{
+    if (fd != g_mock.fd || fd < 0) return __real_close(fd);
+    pthread_mutex_lock(&g_mock.mutex);
+    mock_free_bufs();
+    g_mock.streaming = 0;
+    pthread_mutex_unlock(&g_mock.mutex);
+    return 0;
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...)
+{
+    va_list ap;
+    void   *arg;
+    int     ret;
+
+    va_start(ap, req);
+    arg = va_arg(ap, void*);
+    va_end(ap);
+    if (fd != g_mock.fd || fd < 0) return __real_ioctl(fd, req, arg);
+    pthread_mutex_lock(&g_mock.mutex);
+    ret = mock_ioctl(req, arg);
+    pthread_mutex_unlock(&g_mock.mutex);
+    return ret;
+}
+
+void* __wrap_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+    if (fd != g_mock.fd || fd < 0) return __real_mmap(addr, len, prot, flags, fd, off);
+    if (off / 4096 >= g_mock.nbufs) return MAP_FAILED;
+    return g_mock.bufs[off / 4096];
+}
+
+int __wrap_munmap(void *addr, size_t len)
+{
+    unsigned int i;
+    for (i=0; i<MOCK_MAX_BUFS; i++) {
+        if (addr && addr == g_mock.bufs[i]) return 0;
+    }
+    return __real_munmap(addr, len);
+}
+
+// what the node would report for the poll events asked for, called with the mutex held
+static int
+mock_revents(int events)
+{
+    int revents = 0;
+    if ((events & POLLPRI) && g_mock.ecount) revents |= POLLPRI;
+    if (events & POLLOUT) {
+        if (!g_mock.streaming) revents |= POLLERR;
+        else if (g_mock.ndone) revents |= POLLOUT;
+    }
+    return revents;
+}
+
+static int
+mock_wait(int events, int timeout)
+{
+    struct timespec ts;
+    int revents;
+
+    mock_deadline(&ts, timeout < 0 ? 3600 * 1000 : timeout);
+    pthread_mutex_lock(&g_mock.mutex);
+    while (!(revents = mock_revents(events)) && timeout != 0) {
+        if (pthread_cond_timedwait(&g_mock.cond, &g_mock.mutex, &ts) != 0) break;
+    }
+    pthread_mutex_unlock(&g_mock.mutex);
+    return revents;
+}
+
+int __wrap_select(int nfds, fd_set *r, fd_set *w, fd_set *e, struct timeval *tv)
+{
+    int fd = g_mock.fd, events = 0, revents, n = 0;
+
+    if (fd < 0 || fd >= nfds || !((w && FD_ISSET(fd, w)) || (e && FD_ISSET(fd, e)))) return __real_select(nfds, r, w, e, tv);
+    if (w && FD_ISSET(fd, w)) events |= POLLOUT;
+    if (e && FD_ISSET(fd, e)) events |= POLLPRI;
+    revents = mock_wait(events, tv ? tv->tv_sec * 1000 + tv->tv_usec / 1000 : -1);
+    if (r) FD_ZERO(r);
+    if (w) FD_ZERO(w);
+    if (e) FD_ZERO(e);
+    if (revents & (POLLOUT | POLLERR)) { FD_SET(fd, w); n++; }
+    if (revents & POLLPRI) { FD_SET(fd, e); n++; }
+    return n;
+}
+
+// the node next to real descriptors, the wakeup is drained before the node is
+// looked at so that no change slips in between
+static int
+mock_poll_mixed(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    struct pollfd real[nfds + 1];
+    struct timespec ts;
+    uint64_t cnt;
+    int64_t  end = 0, left;
+    nfds_t   i, m;
+    int      n, ret;
+
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        end = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + timeout;
+    }
+    for (;;) {
+        if (read(g_mock.wake, &cnt, sizeof(cnt)) < 0) {}
+        n = 0;
+        pthread_mutex_lock(&g_mock.mutex);
+        for (i=0; i<nfds; i++) {
+            if (fds[i].fd != g_mock.fd) continue;
+            if ((fds[i].revents = mock_revents(fds[i].events))) n++;
+        }
+        pthread_mutex_unlock(&g_mock.mutex);
+
+        for (i=m=0; i<nfds; i++) {
+            if (fds[i].fd != g_mock.fd) real[m++] = fds[i];
+        }
+        real[m].fd     = g_mock.wake;
+        real[m].events = POLLIN;
+        left = timeout;
+        if (timeout > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            left = end - ts.tv_sec * 1000LL - ts.tv_nsec / 1000000;
+            if (left < 0) left = 0;
+        }
+        if ((ret = __real_poll(real, m + 1, n ? 0 : left)) < 0) return ret;
+        for (i=m=0; i<nfds; i++) {
+            if (fds[i].fd == g_mock.fd) continue;
+            fds[i].revents = real[m++].revents;
+            if (fds[i].revents) n++;
+        }
+        if (n || !ret || !(real[m].revents & POLLIN)) return n;
+    }
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    nfds_t i;
+
+    for (i=0; i<nfds && fds[i].fd!=g_mock.fd; i++);
+    if (g_mock.fd < 0 || i == nfds) return __real_poll(fds, nfds, timeout);
+    if (nfds > 1) return mock_poll_mixed(fds, nfds, timeout);
+    fds[0].revents = mock_wait(fds[0].events, timeout);
+    return fds[0].revents ? 1 : 0;
+}
+
+void mock_gadget_reset(void)
+{
+    pthread_mutex_lock(&g_mock.mutex);
+    g_mock.ehead  = g_mock.ecount = 0;
+    g_mock.nresp  = 0;
+    g_mock.frames = 0;
+    g_mock.bytes  = 0;
+    g_mock.consume = NULL;
+    pthread_mutex_unlock(&g_mock.mutex);
+}
+
+void mock_gadget_consume(void (*fn)(void *opaque, const uint8_t *data, int len), void *opaque)
+{
+    pthread_mutex_lock(&g_mock.mutex);
+    g_mock.consume = fn;
+    g_mock.opaque  = opaque;
+    pthread_mutex_unlock(&g_mock.mutex);
+}
+
+void mock_post_event(unsigned int type, const void *data, int len)
+{
+    struct v4l2_event *ev;
+    struct timespec    ts;
+
+    pthread_mutex_lock(&g_mock.mutex);
+    // wait for room rather than dropping, the library drains the queue
+    mock_deadline(&ts, 1000);
+    while (g_mock.ecount == MOCK_MAX_EVENTS && pthread_cond_timedwait(&g_mock.cond, &g_mock.mutex, &ts) == 0);
+    if (g_mock.ecount < MOCK_MAX_EVENTS) {
+        ev = &g_mock.events[(g_mock.ehead + g_mock.ecount++) % MOCK_MAX_EVENTS];
+        memset(ev, 0, sizeof(*ev));
+        ev->type = type;
+        if (data) memcpy(ev->u.data, data, len < (int)sizeof(ev->u.data) ? len : (int)sizeof(ev->u.data));
+        mock_signal();
+    }
+    pthread_mutex_unlock(&g_mock.mutex);
+}
+
+void mock_post_setup(int req, int cs, int intf, int length)
+{
+    struct usb_ctrlrequest ctrl;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.bRequestType = (req & 0x80 ? USB_DIR_IN : USB_DIR_OUT) | USB_TYPE_CLASS | USB_RECIP_INTERFACE;
+    ctrl.bRequest     = req;
+    ctrl.wValue       = cs << 8;
+    ctrl.wIndex       = intf;
+    ctrl.wLength      = length;
+    mock_post_event(UVC_EVENT_SETUP, &ctrl, sizeof(ctrl));
+}
+
+void mock_post_data(const void *data, int len)
+{
+    struct uvc_request_data d;
+
+    memset(&d, 0, sizeof(d));
+    d.length = len;
+    memcpy(d.data, data, len);
+    mock_post_event(UVC_EVENT_DATA, &d, sizeof(d));
+}
+
+void mock_post_stream(int iformat, int iframe)
+{
+    struct uvc_streaming_control ctrl;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.bFormatIndex = iformat;
+    ctrl.bFrameIndex  = iframe;
+    mock_post_setup(UVC_SET_CUR, UVC_VS_PROBE_CONTROL, UVC_INTF_STREAMING, sizeof(ctrl));
+    mock_post_data(&ctrl, sizeof(ctrl));
+    mock_post_setup(UVC_SET_CUR, UVC_VS_COMMIT_CONTROL, UVC_INTF_STREAMING, sizeof(ctrl));
+    mock_post_data(&ctrl, sizeof(ctrl));
+    mock_post_event(UVC_EVENT_STREAMON, NULL, 0);
+}
+
+int mock_events_pending(void)
+{
+    int n;
+    pthread_mutex_lock(&g_mock.mutex);
+    n = g_mock.ecount;
+    pthread_mutex_unlock(&g_mock.mutex);
+    return n;
+}
+
+static int
+mock_wait_count(uint64_t *counter, uint64_t n, int timeout)
+{
+    struct timespec ts;
+    int ret = 0;
+
+    mock_deadline(&ts, timeout);
+    pthread_mutex_lock(&g_mock.mutex);
+    while (*counter < n && ret == 0) ret = pthread_cond_timedwait(&g_mock.cond, &g_mock.mutex, &ts);
+    ret = *counter < n ? -1 : 0;
+    pthread_mutex_unlock(&g_mock.mutex);
+    return ret;
+}
+
+uint64_t mock_responses(void) { return __atomic_load_n(&g_mock.nresp , __ATOMIC_RELAXED); }
+uint64_t mock_frames   (void) { return __atomic_load_n(&g_mock.frames, __ATOMIC_RELAXED); }
+uint64_t mock_bytes    (void) { return __atomic_load_n(&g_mock.bytes , __ATOMIC_RELAXED); }
+
+int mock_wait_responses(uint64_t n, int timeout) { return mock_wait_count(&g_mock.nresp , n, timeout); }
+int mock_wait_frames   (uint64_t n, int timeout) { return mock_wait_count(&g_mock.frames, n, timeout); }
+
+void mock_format(unsigned int *fcc, int *width, int *height)
+{
+    pthread_mutex_lock(&g_mock.mutex);
+    *fcc    = g_mock.fmt.fmt.pix.pixelformat;
+    *width  = g_mock.fmt.fmt.pix.width;
+    *height = g_mock.fmt.fmt.pix.height;
+    pthread_mutex_unlock(&g_mock.mutex);
+}
@@ -0,0 +1,30 @@
+#ifndef __MOCK_GADGET_H__
+#define __MOCK_GADGET_H__
+
+#include <stdint.h>
+
+// stands in for the uvc gadget node, the bench binaries are linked with --wrap for
+// open/close/ioctl/mmap/munmap/select/poll so that the library talks to it instead,
+// the simulated host drains every buffer as soon as it is queued
+#define MOCK_GADGET_PATH "/dev/mock-uvc"
+
+void     mock_gadget_reset  (void);
+// called for every buffer the host receives
+void     mock_gadget_consume(void (*fn)(void *opaque, const uint8_t *data, int len), void *opaque);
+
+void     mock_post_event(unsigned int type, const void *data, int len);
+void     mock_post_setup(int req, int cs, int intf, int length);
+void     mock_post_data (const void *data, int len);
+// probe and commit format / frame index (1 based) at the default interval, then STREAMON
+void     mock_post_stream(int iformat, int iframe);
+
+int      mock_events_pending(void);
+uint64_t mock_responses(void);
+int      mock_wait_responses(uint64_t n, int timeout); // ms, 0 on success
+uint64_t mock_frames(void);
+uint64_t mock_bytes (void);
+int      mock_wait_frames(uint64_t n, int timeout);
+// size of the committed format from S_FMT
+void     mock_format(unsigned int *fcc, int *width, int *height);
+
+#endif
@@ -6,14 +6,32 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <linux/usb/ch9.h>
 #include <linux/videodev2.h>
 #include "linux/video.h"
 #include "linux/uvc.h"
+#include "uvc_source.h"
+#include "uvc_pool.h"
+#include "uvc_jpeg.h"
+#include "uvc_scale.h"
+#include "uvc_venc.h"
+#include "uvc_ratectl.h"
+#include "uvc_govern.h"
+#include "uvc_audio.h"
+#include "uvc_gadget.h"
+#include "uvc_trace.h"
+#include "uvc_gather.h"
+#include "uvc_osd.h"
+#include "uvc_xu.h"
+#include "uvc_record.h"
+#include "camuvc.h"
 
 #define ARRAY_SIZE(a) ((sizeof(a) / sizeof(a[0])))
 #define clamp(val, min, max) ({                 \
@@ -25,15 +43,32 @@
         __val = __val < __min ? __min: __val;   \
         __val > __max ? __max: __val; })
 
+// time-to-first-frame phases, each stamped once in ns since camuvc_init()
+enum {
+    TTFF_OPEN,
+    TTFF_SUBSCRIBE,
+    TTFF_READY,
+    TTFF_PROBE,    // host
+    TTFF_COMMIT,
+    TTFF_STREAMON, // host
+    TTFF_REQBUFS,
+    TTFF_FRAME,
+    TTFF_QBUF,
+    TTFF_NUM,
+};
+
 struct uvc_device {
     int             vibrate;
 
     #define FLAG_EXIT_ALL    (1 << 0)
     #define FLAG_VENC_INITED (1 << 1)
     #define FLAG_REQUEST_IDR (1 << 2)
+    #define FLAG_SET_BITRATE (1 << 3)
+    #define FLAG_SET_INTERVAL (1 << 4)
     uint32_t        status;
 
-    int             fd;
+    int             fd; // non-blocking, DQBUF answers EAGAIN once every finished buffer is back
+    int             vfd; // eventfd poked on every frame offered, wakes the event thread
     struct uvc_streaming_control probe ;
     struct uvc_streaming_control commit;
 
@@ -48,47 +83,361 @@ struct uvc_device {
     void          **mem;
     unsigned int    nbufs;
     unsigned int    bufsize;
+    unsigned int    idle[8]; // dequeued buffers waiting for a frame
+    int             nidle;
+    unsigned int    bfcc; // format the mapped buffers were sized for
+    int             bwidth;
+    int             bheight;
     unsigned int    bulk;
     uint8_t         color;
 
-    int             vsem;
+    #define UVC_MAX_FANOUT 3
+    int             vsem; // 1: frame offered, 2: being read
+    int             vrefs; // streams holding the current frame, counted on the capturing device
+    struct uvc_device *owner; // capturing device when this stream is fed by fan-out
+    struct uvc_device *fanout[UVC_MAX_FANOUT];
+    int                nfanout;
+    unsigned int    lfcc; // format the capture was started for, what frames without one are
+    int             lwidth;
+    int             lheight;
+    unsigned int    vfcc; // fourcc of vbuf, 0 means it matches fcc
     uint8_t        *vbuf;
     int             vlen;
+    const struct iovec *viov; // vbuf/vlen are unused when set
+    int             viovcnt;
+    int             vwidth;
+    int             vheight;
     int             yoff;
     int             uoff;
+    struct uvc_source *source;
+    struct uvc_source *push; // source when frames come through camuvc_push()
+    struct uvc_venc   *venc;
+    void              *vsess;
+    const struct camuvc_venc_ops *venc_ops;
+    void                         *venc_priv;
+    struct uvc_ratectl ratectl;
+    struct uvc_govern  govern;
+    int                gflags;
+    int                gbudget;
+    int                gbitrate; // bitrate at stream start, what the governor scales
+    int64_t            gread;    // ns the source spent on the frame on offer
+    struct uvc_gather  gather;
+    int                minbps;
+    int                maxbps;
+    struct timespec    tnext;
+    struct uvc_pool   *pool;
+    struct uvc_jpeg   *jpeg;
+    struct uvc_scale  *scale;
+    uint8_t           *sbuf;
+    int                sbufsize;
+    struct uvc_osd    *osd;
+    struct uvc_xu     *xu;
+    struct uvc_record *record; // set, cleared and fed under recmutex
+    int                quality;
+    int                cquality; // committed wCompQuality, 1..100
+    int                maxpayload;
+    int                bulkrate;
+    struct uvc_audio  *audio;
+    int                flags;
+    int64_t            tinit;
+    int64_t            ttff[TTFF_NUM];
     pthread_mutex_t mutex;
+    pthread_mutex_t recmutex;
     pthread_cond_t  cond;
     pthread_t  encthread;
     pthread_t  uvcthread;
 };
 
+static int64_t
+uvc_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *g_ttff_names[TTFF_NUM] = {
+    "open", "subscribe", "ready", "probe", "commit", "streamon", "reqbufs", "frame", "qbuf",
+};
+
+static int
+uvc_ttff_report(struct uvc_device *dev, char *buf, int size)
+{
+    int64_t prev = 0, delta, worst = -1;
+    int     len, i, slowest = -1;
+
+    len = snprintf(buf, size, "time to first frame:\n");
+    for (i=0; i<TTFF_NUM && len<size; i++) {
+        if (!dev->ttff[i]) {
+            len += snprintf(buf + len, size - len, "  %-9s        -\n", g_ttff_names[i]);
+            continue;
+        }
+        delta = dev->ttff[i] - prev;
+        prev  = dev->ttff[i];
+        // time spent waiting for the host says nothing about our own startup
+        if (i != TTFF_PROBE && i != TTFF_STREAMON && delta > worst) {
+            worst   = delta;
+            slowest = i;
+        }
+        len += snprintf(buf + len, size - len, "  %-9s %8.2f ms  +%8.2f ms%s\n", g_ttff_names[i],
+                        dev->ttff[i] / 1000000.0, delta / 1000000.0, (i == TTFF_PROBE || i == TTFF_STREAMON) ? " (host)" : "");
+    }
+    if (slowest >= 0 && len < size) len += snprintf(buf + len, size - len, "  slowest: %s\n", g_ttff_names[slowest]);
+    return len < size ? len : size - 1;
+}
+
+static void
+uvc_ttff_mark(struct uvc_device *dev, int phase)
+{
+    char report[1024];
+    if (dev->ttff[phase]) return;
+    dev->ttff[phase] = uvc_clock_ns() - dev->tinit;
+    if (phase == TTFF_QBUF) {
+        uvc_ttff_report(dev, report, sizeof(report));
+        printf("%s", report);
+    }
+}
+
+// formats the fill path produces from NV12 at any size
+static int
+uvc_video_from_nv12(unsigned int fcc)
+{
+    return fcc == V4L2_PIX_FMT_NV12 || fcc == V4L2_PIX_FMT_MJPEG || fcc == V4L2_PIX_FMT_YUYV || fcc == V4L2_PIX_FMT_UYVY;
+}
+
+// whether stream d can be filled from a frame of fcc at width x height
+static int
+uvc_video_accepts(struct uvc_device *d, unsigned int fcc, int width, int height)
+{
+    if (!d->streamon || (d->status & FLAG_EXIT_ALL)) return 0;
+    if (fcc == V4L2_PIX_FMT_NV12) return uvc_video_from_nv12(d->fcc);
+    return d->fcc == fcc && d->width == width && d->height == height;
+}
+
+static void
+uvc_video_offer(struct uvc_device *dev, struct uvc_device *d, struct camuvc_frame *frame)
+{
+    uint64_t cnt = 1;
+
+    d->vfcc = frame->fcc;
+    d->vbuf = frame->data;
+    d->vlen = frame->len;
+    d->viov = frame->iovcnt > 0 ? frame->iov : NULL;
+    d->viovcnt = frame->iovcnt;
+    d->vwidth  = frame->width;
+    d->vheight = frame->height;
+    d->yoff = frame->yoff;
+    d->uoff = frame->uoff;
+    d->vsem = 1;
+    dev->vrefs++;
+    if (!(d->flags & CAMUVC_INIT_NOTHREAD) && write(d->vfd, &cnt, sizeof(cnt)) < 0) {}
+}
+
+// hand one captured frame to this stream and every stream fanned out from it, all of
+// them read the producer's memory in place. Returns once nobody references it: the
+// first stream taking it paces the producer, streams that were busy elsewhere miss it
+static void
+uvc_video_submit(struct uvc_device *dev, struct camuvc_frame *frame)
+{
+    struct camuvc_frame shared = *frame;
+    struct uvc_device  *pacer  = NULL, *d;
+    int i;
+
+    // the capture may have been started for a secondary, spell out what the frame is
+    shared.fcc    = frame->fcc    ? frame->fcc    : dev->lfcc;
+    shared.width  = frame->width  ? frame->width  : dev->lwidth;
+    shared.height = frame->height ? frame->height : dev->lheight;
+
+    UVC_TRACE_BEGIN("submit");
+    pthread_mutex_lock(&dev->mutex);
+    if (dev->streamon && (shared.fcc == dev->fcc || (shared.fcc == V4L2_PIX_FMT_NV12 && uvc_video_from_nv12(dev->fcc)))) {
+        uvc_video_offer(dev, dev, &shared);
+        pacer = dev;
+    }
+    for (i=0; i<dev->nfanout; i++) {
+        d = dev->fanout[i];
+        if (!uvc_video_accepts(d, shared.fcc, shared.width, shared.height)) continue;
+        uvc_video_offer(dev, d, &shared);
+        if (!pacer) pacer = d;
+    }
+    pthread_cond_broadcast(&dev->cond);
+    while (pacer && pacer->vsem && pacer->streamon && !(pacer->status & FLAG_EXIT_ALL) && !(dev->status & FLAG_EXIT_ALL)) {
+        pthread_cond_wait(&dev->cond, &dev->mutex);
+    }
+
+    // withdraw the frame where it was not picked up, then wait for the readers
+    if (dev->vsem == 1) { dev->vsem = 0; dev->vrefs--; }
+    for (i=0; i<dev->nfanout; i++) {
+        if (dev->fanout[i]->vsem == 1) { dev->fanout[i]->vsem = 0; dev->vrefs--; }
+    }
+    while (dev->vrefs > 0 && !(dev->status & FLAG_EXIT_ALL)) pthread_cond_wait(&dev->cond, &dev->mutex);
+    pthread_mutex_unlock(&dev->mutex);
+    UVC_TRACE_END("submit");
+}
+
+// the capture runs while this stream or any stream fed from it is on
+static int
+uvc_video_active(struct uvc_device *dev)
+{
+    int i;
+    if (dev->streamon) return 1;
+    for (i=0; i<dev->nfanout; i++) {
+        if (dev->fanout[i]->streamon) return 1;
+    }
+    return 0;
+}
+
+// the stream the capture runs for: this one while it is on, else the first stream fed
+// from it that is. Its format is copied out under the mutex, a secondary may be gone
+// as soon as that is released
+static struct uvc_device*
+uvc_video_lead(struct uvc_device *dev, struct camuvc_venc_params *params)
+{
+    struct uvc_device *lead;
+    int i;
+
+    pthread_mutex_lock(&dev->mutex);
+    lead = dev->streamon ? dev : NULL;
+    for (i=0; !lead && i<dev->nfanout; i++) {
+        if (dev->fanout[i]->streamon) lead = dev->fanout[i];
+    }
+    if (lead) {
+        params->fcc      = lead->fcc;
+        params->width    = lead->width;
+        params->height   = lead->height;
+        params->interval = lead->commit.dwFrameInterval;
+        params->bitrate  = lead->vibrate;
+    }
+    pthread_mutex_unlock(&dev->mutex);
+    return lead;
+}
+
+static void
+uvc_video_pace(struct uvc_device *dev)
+{
+    struct timespec now;
+    int64_t interval = uvc_govern_interval(&dev->govern);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dev->tnext.tv_nsec += interval;
+    while (dev->tnext.tv_nsec >= 1000000000) {
+        dev->tnext.tv_nsec -= 1000000000;
+        dev->tnext.tv_sec  += 1;
+    }
+    // fell behind by more than one interval, resync instead of bursting
+    if ((now.tv_sec - dev->tnext.tv_sec) * 1000000000LL + now.tv_nsec - dev->tnext.tv_nsec > interval) {
+        dev->tnext = now;
+        return;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &dev->tnext, NULL);
+}
+
+static void
+uvc_video_pump_source(struct uvc_device *dev)
+{
+    struct camuvc_frame frame;
+    int64_t t0 = uvc_clock_ns();
+
+    memset(&frame, 0, sizeof(frame));
+    if (dev->source->read(dev->source, &frame) < 0) {
+        usleep(10*1000);
+        return;
+    }
+    // a source that does not set its own pace may block in read, that is not work
+    dev->gread = dev->source->paced ? uvc_clock_ns() - t0 : 0;
+    if (dev->source->paced) uvc_video_pace(dev);
+    if (uvc_govern_skip(&dev->govern)) return;
+    uvc_video_submit(dev, &frame);
+}
+
+static void
+uvc_video_pump_encoder(struct uvc_device *dev)
+{
+    const struct camuvc_venc_ops *ops = dev->venc_ops;
+    struct camuvc_frame frame;
+
+    memset(&frame, 0, sizeof(frame));
+    if (ops->read(dev->venc_priv, dev->vsess, &frame) < 0) {
+        usleep(10*1000);
+        return;
+    }
+    dev->gread = 0;
+    if (uvc_govern_skip(&dev->govern)) return;
+    uvc_video_submit(dev, &frame);
+}
+
+static void
+uvc_video_select_encoder(struct uvc_device *dev, struct camuvc_venc_params *params)
+{
+    int fresh;
+
+    dev->vsess = uvc_venc_get(dev->venc, params, &fresh);
+    if (fresh) dev->status &= ~FLAG_REQUEST_IDR;
+}
+
 static void* main_video_capture_proc(void *argv)
 {
     struct uvc_device *dev     = (struct uvc_device*)argv;
+    struct uvc_device *lead, *led = NULL;
+    struct camuvc_venc_params params;
+    int                srcok   = 0;
 
     while (!(dev->status & FLAG_EXIT_ALL)) {
-        if (!dev->streamon) {
+        if (dev->owner || !(lead = uvc_video_lead(dev, &params))) {
+            // a producer gets the frame it pushed last back while nobody streams
+            if (led && dev->push) uvc_push_flush(dev->push, 1);
+            led = NULL;
             usleep(100*1000);
             continue;
         }
 
-        //++ reinit video main stream
-        if (!(dev->status & FLAG_VENC_INITED)) {
+        //++ reinit video main stream, also when another stream takes the lead
+        if (!(dev->status & FLAG_VENC_INITED) || lead != led) {
             dev->status |= FLAG_VENC_INITED;
-            // todo..
+            led          = lead;
+            dev->lfcc    = params.fcc;
+            dev->lwidth  = params.width;
+            dev->lheight = params.height;
+            // a secondary streaming on its own is paced at its own frame interval
+            if (lead != dev) uvc_govern_reset(&dev->govern, 0, 0, params.interval);
+            if (dev->source) {
+                srcok = dev->source->start(dev->source, params.fcc, params.width, params.height) == 0;
+                clock_gettime(CLOCK_MONOTONIC, &dev->tnext);
+            } else if (dev->venc) {
+                uvc_video_select_encoder(dev, &params);
+            }
         }
         //-- reinit video main stream
 
+        if (dev->source) {
+            if (srcok) uvc_video_pump_source(dev);
+            else usleep(100*1000);
+            continue;
+        }
+
         if (dev->status & FLAG_REQUEST_IDR) {
             dev->status &= ~FLAG_REQUEST_IDR;
-            // todo..
+            if (dev->vsess && dev->venc_ops->idr) dev->venc_ops->idr(dev->venc_priv, dev->vsess);
         }
 
-        if (dev->fcc == V4L2_PIX_FMT_NV12) {
-            // todo...
-        } else {
-            // todo...
+        if (dev->status & FLAG_SET_BITRATE) {
+            dev->status &= ~FLAG_SET_BITRATE;
+            if (dev->vsess) uvc_venc_set_bitrate(dev->venc, dev->vibrate);
+        }
+
+        if (dev->status & FLAG_SET_INTERVAL) {
+            dev->status &= ~FLAG_SET_INTERVAL;
+            if (dev->vsess) uvc_venc_set_interval(dev->venc, uvc_govern_interval(&dev->govern) / 100);
         }
+
+        if (dev->venc) {
+            if (dev->vsess) uvc_video_pump_encoder(dev);
+            else usleep(100*1000);
+            continue;
+        }
+
+        // neither a source nor an encoder was set, nothing to pump
+        usleep(100*1000);
     }
 
     return NULL;
@@ -96,17 +445,17 @@ static void* main_video_capture_proc(void *argv)
 //-- 313e platform
 
 static struct uvc_device *
-uvc_open(const char *devname)
+uvc_open(const char *devname, int reopen)
 {
     struct uvc_device *dev;
     struct v4l2_capability cap;
     int ret;
     int fd;
 
-    fd = open(devname, O_RDWR);
-    if (1) {
+    fd = open(devname, O_RDWR | O_NONBLOCK);
+    if (reopen && fd != -1) {
         close(fd);
-        fd = open(devname, O_RDWR);
+        fd = open(devname, O_RDWR | O_NONBLOCK);
     }
     if (fd == -1) {
         printf("v4l2 open failed: %s (%d)\n", strerror(errno), errno);
@@ -130,13 +479,31 @@ uvc_open(const char *devname)
         return NULL;
     }
 
-    dev->fd = fd;
+    dev->fd  = fd;
+    dev->vfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (dev->vfd < 0) {
+        printf("unable to create eventfd: %s (%d)\n", strerror(errno), errno);
+        close(fd);
+        free(dev);
+        return NULL;
+    }
     return dev;
 }
 
 static void
 uvc_close(struct uvc_device *dev)
 {
+    uvc_audio_close(dev->audio);
+    if (dev->source) dev->source->close(dev->source);
+    uvc_venc_destroy(dev->venc);
+    uvc_jpeg_destroy(dev->jpeg);
+    uvc_scale_destroy(dev->scale);
+    free(dev->sbuf);
+    uvc_osd_destroy(dev->osd);
+    uvc_xu_destroy(dev->xu);
+    uvc_record_close(dev->record);
+    uvc_pool_destroy(dev->pool);
+    close(dev->vfd);
     close(dev->fd);
     free(dev->mem);
     free(dev);
@@ -146,63 +513,286 @@ uvc_close(struct uvc_device *dev)
  * Video streaming
  */
 
-static void
-uvc_video_fill_buffer(struct uvc_device *dev, struct v4l2_buffer *buf)
+static struct uvc_pool*
+uvc_video_pool(struct uvc_device *dev)
 {
-    int len, ncopy;
+    // without threads of our own the pool runs everything on the caller
+    if (!dev->pool) dev->pool = uvc_pool_create(dev->flags & CAMUVC_INIT_NOTHREAD ? 1 : 0);
+    return dev->pool;
+}
 
-    pthread_mutex_lock(&dev->mutex);
-    while (dev->vsem == 0 && !(dev->status & FLAG_EXIT_ALL)) pthread_cond_wait(&dev->cond, &dev->mutex);
-    pthread_mutex_unlock(&dev->mutex);
-    if (dev->status & FLAG_EXIT_ALL) return;
+// locate the NV12 picture at the committed size, resampling it into dst when the
+// producer runs at another resolution, returns 1 if the picture was written to dst
+static int
+uvc_video_nv12_picture(struct uvc_device *dev, uint8_t *dst, const uint8_t **y, const uint8_t **uv)
+{
+    int sw = dev->vwidth  ? dev->vwidth  : dev->width;
+    int sh = dev->vheight ? dev->vheight : dev->height;
 
-    if (dev->fcc == V4L2_PIX_FMT_NV12) {
-        memcpy(dev->mem[buf->index] + 0                       , dev->vbuf + dev->yoff, dev->width * dev->height / 1);
-        memcpy(dev->mem[buf->index] + dev->width * dev->height, dev->vbuf + dev->uoff, dev->width * dev->height / 2);
-        buf->bytesused = dev->maxfsize;
-    } else {
-        len   = dev->vlen;
-        ncopy = len < dev->maxfsize ? len : dev->maxfsize;
-        memcpy(dev->mem[buf->index], dev->vbuf, ncopy);
-        buf->bytesused = ncopy;
+    *y  = dev->vbuf + dev->yoff;
+    *uv = dev->vbuf + dev->uoff;
+    if (sw == dev->width && sh == dev->height) return 0;
+
+    if (!dev->scale) dev->scale = uvc_scale_create(uvc_video_pool(dev));
+    if (!dev->scale || uvc_scale_nv12(dev->scale, dst, dst + dev->width * dev->height, dev->width, dev->height, dev->width,
+                                      *y, *uv, sw, sh, sw) < 0) {
+        return -1;
     }
+    *y  = dst;
+    *uv = dst + dev->width * dev->height;
+    return 1;
+}
 
-    pthread_mutex_lock(&dev->mutex);
-    dev->vsem = 0;
-    pthread_cond_signal(&dev->cond);
-    pthread_mutex_unlock(&dev->mutex);
+// the NV12 picture at the committed size for streams that convert it, resampled
+// into sbuf when the producer runs at another resolution, the producer's memory is
+// never written so with overlays on the picture is staged in sbuf for blending
+static int
+uvc_video_scaled_picture(struct uvc_device *dev, const uint8_t **y, const uint8_t **uv)
+{
+    int len = dev->width * dev->height * 3 / 2, osd = uvc_osd_active(dev->osd), ret;
+
+    if ((osd || (dev->vwidth && (dev->vwidth != dev->width || dev->vheight != dev->height))) && dev->sbufsize < len) {
+        free(dev->sbuf);
+        dev->sbuf     = malloc(len);
+        dev->sbufsize = dev->sbuf ? len : 0;
+        if (!dev->sbuf) return -1;
+    }
+    if ((ret = uvc_video_nv12_picture(dev, dev->sbuf, y, uv)) < 0) return -1;
+    if (osd) {
+        if (ret == 0) {
+            memcpy(dev->sbuf                           , *y , dev->width * dev->height / 1);
+            memcpy(dev->sbuf + dev->width * dev->height, *uv, dev->width * dev->height / 2);
+        }
+        uvc_osd_blend(dev->osd, dev->sbuf, dev->sbuf + dev->width * dev->height, dev->width, dev->height, dev->width);
+        *y  = dev->sbuf;
+        *uv = dev->sbuf + dev->width * dev->height;
+    }
+    return 0;
 }
 
+// YUYV / UYVY are interleaved straight into the gadget buffer
 static int
-uvc_video_process(struct uvc_device *dev)
+uvc_video_pack_422(struct uvc_device *dev, struct v4l2_buffer *buf)
 {
-    struct v4l2_buffer buf;
-    int    ret;
+    const uint8_t *y, *uv;
+
+    if ((int)dev->bufsize < dev->width * dev->height * 2) return 0;
+    if (uvc_video_scaled_picture(dev, &y, &uv) < 0) return 0;
+    if (!dev->scale) dev->scale = uvc_scale_create(uvc_video_pool(dev));
+    if (!dev->scale || uvc_scale_pack(dev->scale, dev->mem[buf->index], dev->fcc, dev->width, dev->height, dev->width * 2,
+                                      y, uv, dev->width) < 0) {
+        return 0;
+    }
+    return dev->width * dev->height * 2;
+}
 
-    if (!dev->streamon) {
-        usleep(100*1000);
-        return -1;
+static int
+uvc_video_encode_mjpeg(struct uvc_device *dev, struct v4l2_buffer *buf)
+{
+    const uint8_t *y, *uv;
+    int size = dev->maxfsize < (int)dev->bufsize ? dev->maxfsize : (int)dev->bufsize;
+    int len;
+
+    if (!dev->jpeg) {
+        dev->jpeg = uvc_jpeg_create(uvc_video_pool(dev));
+        if (!dev->jpeg) return 0;
     }
+    if (uvc_video_scaled_picture(dev, &y, &uv) < 0) return 0;
 
-    memset(&buf, 0, sizeof buf);
-    buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    buf.memory = V4L2_MEMORY_MMAP;
+    len = uvc_jpeg_encode(dev->jpeg, dev->mem[buf->index], size, y, uv, dev->width, dev->height, dev->width, dev->cquality);
+    if (len < 0) {
+        printf("mjpeg frame does not fit into %d bytes, dropped !\n", size);
+        return 0;
+    }
+    return len;
+}
 
-    if ((ret = ioctl(dev->fd, VIDIOC_DQBUF, &buf)) < 0) {
-        printf("unable to dequeue buffer: %s (%d).\n", strerror(errno), errno);
+// which of the requested governor fallbacks this stream can use, inter coded
+// frames are never dropped
+static int
+uvc_video_govern_flags(struct uvc_device *dev)
+{
+    int h26x  = dev->fcc == v4l2_fourcc('H','2','6','4') || dev->fcc == v4l2_fourcc('H','2','6','5');
+    int venc  = !dev->source && dev->venc && dev->venc_ops->reconfig;
+    int flags = 0;
+
+    if ((dev->gflags & CAMUVC_GOVERN_FPS) && (dev->source ? dev->source->paced : venc)) {
+        flags |= GOVERN_FPS;
+    } else if ((dev->gflags & CAMUVC_GOVERN_SKIP) && !h26x) {
+        flags |= GOVERN_SKIP;
+    }
+    if ((dev->gflags & CAMUVC_GOVERN_BITRATE) && h26x && venc) flags |= GOVERN_BITRATE;
+    return flags;
+}
+
+static void
+uvc_video_governed(struct uvc_device *dev)
+{
+    struct uvc_govern *g = &dev->govern;
+
+    printf("governor level %d: %d/%d of the frame rate, %d%% bitrate, %d late frames so far\n", g->level,
+           g->levels[g->level].num, g->levels[g->level].den, g->levels[g->level].pct, g->underruns);
+    // paced sources pick the new interval up on their next frame
+    if (g->flags & GOVERN_FPS) dev->status |= FLAG_SET_INTERVAL;
+    if (g->flags & GOVERN_BITRATE) {
+        dev->vibrate = uvc_govern_bitrate(g, dev->maxbps ? dev->ratectl.target : dev->gbitrate);
+        dev->status |= FLAG_SET_BITRATE;
+    }
+}
+
+// fill buf from the frame on offer, returns 0 without waiting if there is none
+static int
+uvc_video_fill_buffer(struct uvc_device *dev, struct v4l2_buffer *buf)
+{
+    struct uvc_device *src = dev->owner ? dev->owner : dev;
+    const uint8_t *y, *uv;
+    struct iovec   one;
+    int64_t t0, now;
+    int size, ret;
+
+    pthread_mutex_lock(&src->mutex);
+    if (dev->vsem == 1) dev->vsem = 2;
+    pthread_mutex_unlock(&src->mutex);
+    if (dev->vsem != 2) return 0;
+    uvc_ttff_mark(dev, TTFF_FRAME);
+    t0 = uvc_clock_ns();
+
+    if (dev->fcc == V4L2_PIX_FMT_MJPEG && dev->vfcc == V4L2_PIX_FMT_NV12) {
+        buf->bytesused = uvc_video_encode_mjpeg(dev, buf);
+    } else if ((dev->fcc == V4L2_PIX_FMT_YUYV || dev->fcc == V4L2_PIX_FMT_UYVY) && dev->vfcc == V4L2_PIX_FMT_NV12) {
+        buf->bytesused = uvc_video_pack_422(dev, buf);
+    } else if (dev->fcc == V4L2_PIX_FMT_NV12) {
+        // nothing was written when resampling failed, the buffer goes out empty
+        if ((ret = uvc_video_nv12_picture(dev, dev->mem[buf->index], &y, &uv)) == 0) {
+            memcpy(dev->mem[buf->index] + 0                       , y , dev->width * dev->height / 1);
+            memcpy(dev->mem[buf->index] + dev->width * dev->height, uv, dev->width * dev->height / 2);
+        }
+        if (ret >= 0) uvc_osd_blend(dev->osd, dev->mem[buf->index], dev->mem[buf->index] + dev->width * dev->height, dev->width, dev->height, dev->width);
+        buf->bytesused = ret >= 0 ? dev->maxfsize : 0;
+    } else {
+        size = dev->maxfsize < (int)dev->bufsize ? dev->maxfsize : (int)dev->bufsize;
+        if (dev->viov) {
+            buf->bytesused = uvc_gather_frame(&dev->gather, dev->mem[buf->index], size, dev->viov, dev->viovcnt);
+        } else {
+            one.iov_base   = dev->vbuf;
+            one.iov_len    = dev->vlen;
+            buf->bytesused = uvc_gather_frame(&dev->gather, dev->mem[buf->index], size, &one, 1);
+        }
+    }
+
+    // the capturing stream governs what it produces for every stream fed from it
+    now = uvc_clock_ns();
+    if (!dev->owner && uvc_govern_frame(&dev->govern, now - t0 + dev->gread, now)) uvc_video_governed(dev);
+
+    pthread_mutex_lock(&src->mutex);
+    dev->vsem = 0;
+    src->vrefs--;
+    pthread_cond_broadcast(&src->cond);
+    pthread_mutex_unlock(&src->mutex);
+
+    // the tee sees exactly what goes to the host, a copy into its ring and a wakeup,
+    // taken from the gadget buffer that is still ours so the fan-out does not wait on it
+    if (dev->fcc != V4L2_PIX_FMT_NV12 && dev->fcc != V4L2_PIX_FMT_YUYV && dev->fcc != V4L2_PIX_FMT_UYVY && buf->bytesused) {
+        pthread_mutex_lock(&dev->recmutex);
+        if (dev->record) uvc_record_frame(dev->record, dev->fcc, dev->mem[buf->index], buf->bytesused);
+        pthread_mutex_unlock(&dev->recmutex);
+    }
+    return 1;
+}
+
+static int
+uvc_video_dequeue(struct uvc_device *dev, struct v4l2_buffer *buf)
+{
+    int ret;
+
+    memset(buf, 0, sizeof *buf);
+    buf->type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf->memory = V4L2_MEMORY_MMAP;
+
+    UVC_TRACE_BEGIN("dqbuf");
+    ret = ioctl(dev->fd, VIDIOC_DQBUF, buf);
+    UVC_TRACE_END("dqbuf");
+    if (ret < 0) {
+        if (errno != EAGAIN) printf("unable to dequeue buffer: %s (%d).\n", strerror(errno), errno);
         return ret;
     }
 
-    uvc_video_fill_buffer(dev, &buf);
+    if ((ret = uvc_ratectl_done(&dev->ratectl, buf->index, uvc_clock_ns())) > 0) {
+        printf("drain %d bps, delay %d us, bitrate -> %d\n", dev->ratectl.drainbps, dev->ratectl.delayus, ret);
+        dev->vibrate = uvc_govern_bitrate(&dev->govern, ret);
+        dev->status |= FLAG_SET_BITRATE;
+    }
+    return 0;
+}
 
-    if ((ret = ioctl(dev->fd, VIDIOC_QBUF, &buf)) < 0) {
+static int
+uvc_video_queue(struct uvc_device *dev, struct v4l2_buffer *buf)
+{
+    int ret;
+
+    UVC_TRACE_BEGIN("qbuf");
+    ret = ioctl(dev->fd, VIDIOC_QBUF, buf);
+    UVC_TRACE_END("qbuf");
+    if (ret < 0) {
         printf("unable to requeue buffer: %s (%d).\n", strerror(errno), errno);
         return ret;
     }
-
+    uvc_ratectl_queued(&dev->ratectl, buf->index, buf->bytesused, uvc_clock_ns());
     return 0;
 }
 
+// poll events worth waiting for, POLLOUT only while a queued buffer is owed back,
+// asking for it outside streaming would report POLLERR on every wakeup
+static int
+uvc_video_poll_events(struct uvc_device *dev)
+{
+    return POLLPRI | (dev->streamon && dev->nidle < (int)dev->nbufs ? POLLOUT : 0);
+}
+
+// take back up to max of the buffers the host is done with, returns how many
+static int
+uvc_video_reclaim(struct uvc_device *dev, int max)
+{
+    struct v4l2_buffer buf;
+    int n;
+
+    for (n=0; n<max && dev->nidle<(int)ARRAY_SIZE(dev->idle); n++) {
+        if (uvc_video_dequeue(dev, &buf) < 0) break;
+        dev->idle[dev->nidle++] = buf.index;
+    }
+    return n;
+}
+
+// fill idle buffers while frames are on offer, then queue them back in one go
+static int
+uvc_video_refill(struct uvc_device *dev)
+{
+    struct v4l2_buffer bufs[ARRAY_SIZE(dev->idle)];
+    int n = 0, i, ret, queued = 0;
+
+    while (n < dev->nidle) {
+        memset(&bufs[n], 0, sizeof bufs[n]);
+        bufs[n].index  = dev->idle[dev->nidle - 1 - n];
+        bufs[n].type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        bufs[n].memory = V4L2_MEMORY_MMAP;
+        UVC_TRACE_BEGIN("fill_buffer");
+        ret = uvc_video_fill_buffer(dev, &bufs[n]);
+        UVC_TRACE_END("fill_buffer");
+        if (!ret) break;
+        n++;
+    }
+    dev->nidle -= n;
+    for (i=0; i<n; i++) {
+        if (uvc_video_queue(dev, &bufs[i]) < 0) {
+            dev->idle[dev->nidle++] = bufs[i].index;
+            continue;
+        }
+        uvc_ttff_mark(dev, TTFF_QBUF);
+        queued++;
+    }
+    return queued;
+}
+
 static int
 uvc_video_reqbufs(struct uvc_device *dev, int nbufs)
 {
@@ -217,6 +807,7 @@ uvc_video_reqbufs(struct uvc_device *dev, int nbufs)
     free(dev->mem);
     dev->mem   = 0;
     dev->nbufs = 0;
+    dev->nidle = 0;
 
     memset(&rb, 0, sizeof rb);
     rb.count  = nbufs;
@@ -259,35 +850,48 @@ uvc_video_reqbufs(struct uvc_device *dev, int nbufs)
 
     dev->bufsize = buf.length;
     dev->nbufs   = rb.count;
+    dev->bfcc    = dev->fcc;
+    dev->bwidth  = dev->width;
+    dev->bheight = dev->height;
+    if (rb.count) uvc_ttff_mark(dev, TTFF_REQBUFS);
     return 0;
 }
 
 static int
 uvc_video_stream(struct uvc_device *dev, int enable)
 {
-    struct v4l2_buffer buf;
+    struct uvc_device *src = dev->owner ? dev->owner : dev;
     int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    int ret, i;
+    int ret;
     if (enable) {
         printf("starting video stream.\n");
         dev->status  &= ~FLAG_VENC_INITED;
+        dev->status  |=  FLAG_REQUEST_IDR;
         dev->streamon = 1;
-        for (i=0; i<dev->nbufs; ++i) {
-            memset(&buf, 0, sizeof buf);
-            buf.index  = i;
-            buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-            buf.memory = V4L2_MEMORY_MMAP;
-            uvc_video_fill_buffer(dev, &buf);
-            printf("queueing buffer %u.\n", i);
-            if ((ret = ioctl(dev->fd, VIDIOC_QBUF, &buf)) < 0) {
-                printf("unable to queue buffer: %s (%d).\n", strerror(errno), errno);
-                break;
-            }
+        if (dev->fcc == v4l2_fourcc('H','2','6','4') || dev->fcc == v4l2_fourcc('H','2','6','5')) {
+            uvc_ratectl_reset(&dev->ratectl, dev->minbps, dev->maxbps, dev->vibrate, dev->commit.dwFrameInterval);
+            if (dev->maxbps) dev->vibrate = dev->ratectl.target;
+        } else {
+            uvc_ratectl_reset(&dev->ratectl, 0, 0, 0, 0);
         }
+        dev->gbitrate = dev->vibrate;
+        dev->gread    = 0;
+        uvc_govern_reset(&dev->govern, uvc_video_govern_flags(dev), dev->gbudget, dev->commit.dwFrameInterval);
+        // every buffer starts idle, they are queued as frames come in and the event
+        // loop never waits on the producer
+        for (dev->nidle=0; dev->nidle<(int)dev->nbufs && dev->nidle<(int)ARRAY_SIZE(dev->idle); dev->nidle++) {
+            dev->idle[dev->nidle] = dev->nidle;
+        }
+        if ((dev->flags & CAMUVC_INIT_NOTHREAD) && dev->push) dev->push->start(dev->push, dev->fcc, dev->width, dev->height);
         ret = ioctl(dev->fd, VIDIOC_STREAMON, &type);
     } else {
         printf("stopping video stream.\n");
+        // a producer blocked handing us a frame sees this and moves on
+        pthread_mutex_lock(&src->mutex);
         dev->streamon = 0;
+        pthread_cond_broadcast(&src->cond);
+        pthread_mutex_unlock(&src->mutex);
+        dev->nidle = 0;
         ret = ioctl(dev->fd, VIDIOC_STREAMOFF, &type);
     }
     return ret;
@@ -315,6 +919,10 @@ uvc_video_set_format(struct uvc_device *dev)
     case V4L2_PIX_FMT_NV12:
         fmt.fmt.pix.sizeimage = dev->width * dev->height * 1.5;
         break;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        fmt.fmt.pix.sizeimage = dev->width * dev->height * 2;
+        break;
     case V4L2_PIX_FMT_MJPEG:
         fmt.fmt.pix.sizeimage = dev->width * dev->height * 1.5 / 3;
         break;
@@ -337,6 +945,22 @@ uvc_video_init(struct uvc_device *dev __attribute__((__unused__)))
     return 0;
 }
 
+static void* main_video_capture_proc(void *argv);
+
+// runs on commit, brings up whatever the committed format needs before the host
+// starts streaming so none of it lands on the first frame
+static void
+uvc_video_prepare(struct uvc_device *dev)
+{
+    if (!(dev->flags & CAMUVC_INIT_NOTHREAD) && !dev->encthread && pthread_create(&dev->encthread, NULL, main_video_capture_proc, dev) != 0) {
+        printf("failed to create video capture thread !\n");
+        dev->encthread = 0;
+    }
+    if (dev->fcc == V4L2_PIX_FMT_MJPEG && !dev->venc && !dev->source && !dev->jpeg) {
+        dev->jpeg = uvc_jpeg_create(uvc_video_pool(dev));
+    }
+}
+
 /* ---------------------------------------------------------------------------
  * Request processing
  */
@@ -352,30 +976,37 @@ struct uvc_format_info {
 };
 
 static const struct uvc_frame_info uvc_frames_nv12[] = {
-    { 320 , 240 , { 1000000000 / 25 / 100, 0 } },
-    { 640 , 480 , { 1000000000 / 25 / 100, 0 } },
-    { 1280, 720 , { 1000000000 / 15 / 100, 0 } },
+    { 320 , 240 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 640 , 480 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1280, 720 , { 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    {},
+};
+
+static const struct uvc_frame_info uvc_frames_yuyv[] = {
+    { 320 , 240 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 640 , 480 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1280, 720 , { 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
     {},
 };
 
 static const struct uvc_frame_info uvc_frames_mjpeg[] = {
-    { 640 , 480 , { 1000000000 / 25 / 100, 0 } },
-    { 1280, 720 , { 1000000000 / 25 / 100, 0 } },
-    { 1920, 1080, { 1000000000 / 25 / 100, 0 } },
+    { 640 , 480 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1280, 720 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1920, 1080, { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
     {},
 };
 
 static const struct uvc_frame_info uvc_frames_h264[] = {
-    { 640 , 480 , { 1000000000 / 25 / 100, 0 } },
-    { 1280, 720 , { 1000000000 / 25 / 100, 0 } },
-    { 1920, 1080, { 1000000000 / 25 / 100, 0 } },
+    { 640 , 480 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1280, 720 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1920, 1080, { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
     {},
 };
 
 static const struct uvc_frame_info uvc_frames_h265[] = {
-    { 640 , 480 , { 1000000000 / 25 / 100, 0 } },
-    { 1280, 720 , { 1000000000 / 25 / 100, 0 } },
-    { 1920, 1080, { 1000000000 / 25 / 100, 0 } },
+    { 640 , 480 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1280, 720 , { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
+    { 1920, 1080, { 1000000000 / 25 / 100, 1000000000 / 15 / 100, 1000000000 / 10 / 100, 1000000000 / 5 / 100, 0 } },
     {},
 };
 
@@ -384,15 +1015,142 @@ static const struct uvc_format_info uvc_formats[] = {
     { V4L2_PIX_FMT_MJPEG, uvc_frames_mjpeg },
     { v4l2_fourcc('H','2','6','4'), uvc_frames_h264 },
     { v4l2_fourcc('H','2','6','5'), uvc_frames_h265 },
+    { V4L2_PIX_FMT_YUYV , uvc_frames_yuyv  },
+    { V4L2_PIX_FMT_UYVY , uvc_frames_yuyv  },
 };
 
+// also what the gadget advertises as dwMaxVideoFrameBufferSize, keep both in step
+static unsigned int
+uvc_max_frame_size(unsigned int fcc, int width, int height)
+{
+    switch (fcc) {
+    case V4L2_PIX_FMT_NV12           : return width * height * 1.5;
+    case V4L2_PIX_FMT_YUYV           :
+    case V4L2_PIX_FMT_UYVY           : return width * height * 2;
+    case V4L2_PIX_FMT_MJPEG          : return width * height * 1.5 / 3;
+    case v4l2_fourcc('H','2','6','4'): return width * height * 1.5 / 4;
+    case v4l2_fourcc('H','2','6','5'): return width * height * 1.5 / 5;
+    }
+    return 0;
+}
+
+static int
+uvc_default_bitrate(int width)
+{
+    switch (width) {
+    case 1920: return 3000*1000;
+    case 1280: return 2000*1000;
+    default  : return 1000*1000;
+    }
+}
+
+// bytes per second the streaming endpoint carries, payload is what one (micro)frame moves,
+// bulk has no reserved bandwidth so it goes by what camuvc_set_bulk_rate() was told
+static int64_t
+uvc_link_capacity(struct uvc_device *dev, unsigned int payload)
+{
+    if (dev->bulk) return dev->bulkrate;
+    return (int64_t)(payload > 12 ? payload - 12 : 0) * 8000; // high speed, less the payload header
+}
+
+// bytes per second a mode needs on the wire, compressed formats are estimated on the high side
+static int64_t
+uvc_mode_bandwidth(unsigned int fcc, int width, int height, unsigned int interval, int quality, int keyframe)
+{
+    int64_t size;
+
+    switch (fcc) {
+    case V4L2_PIX_FMT_MJPEG:
+        size = (int64_t)width * height * (10 + 60 * quality / 100) / 100;
+        if (size > uvc_max_frame_size(fcc, width, height)) size = uvc_max_frame_size(fcc, width, height);
+        return size * 10000000 / interval;
+    case v4l2_fourcc('H','2','6','4'):
+    case v4l2_fourcc('H','2','6','5'):
+        // rate controlled, frequent key frames make the bursts larger
+        return (int64_t)uvc_default_bitrate(width) / 8 * (keyframe > 0 && keyframe < 25 ? 3 : 5) / 4;
+    }
+    return (int64_t)uvc_max_frame_size(fcc, width, height) * 10000000 / interval;
+}
+
+#define UVC_HINT_FRAME_INTERVAL (1 << 0)
+#define UVC_HINT_COMP_QUALITY   (1 << 3)
+
+// settle the interval and compression closest to what req asks for that the endpoint
+// can carry, fields fixed through bmHint are only given up when nothing else fits,
+// returns -1 when the frame does not fit at all
+static int
+uvc_negotiate_mode(struct uvc_device *dev, struct uvc_streaming_control *out, unsigned int fcc,
+                   const struct uvc_frame_info *frame, const struct uvc_streaming_control *req, unsigned int payload)
+{
+    const unsigned int *iv = frame->intervals;
+    int64_t capacity;
+    int     hint = 0, quality = dev->quality, keyframe = 0, pass;
+
+    if (req) {
+        hint     = req->bmHint;
+        keyframe = req->wKeyFrameRate;
+        if (req->wCompQuality) quality = clamp(req->wCompQuality / 100, 1, 100);
+        while (iv[0] < req->dwFrameInterval && iv[1]) ++iv;
+    }
+    if (fcc != V4L2_PIX_FMT_MJPEG) hint |= UVC_HINT_COMP_QUALITY;
+    capacity = uvc_link_capacity(dev, payload);
+
+    #define UVC_NEED() uvc_mode_bandwidth(fcc, frame->width, frame->height, *iv, quality, keyframe)
+    // first trade some quality, then frame rate, then quality down to the floor,
+    // and only then ignore the hint rather than let the stream underrun
+    for (pass=0; pass<2 && UVC_NEED() > capacity; pass++) {
+        if (!(hint & UVC_HINT_COMP_QUALITY)) while (quality > 50 && UVC_NEED() > capacity) quality -= 5;
+        if (!(hint & UVC_HINT_FRAME_INTERVAL)) while (iv[1] && UVC_NEED() > capacity) ++iv;
+        if (!(hint & UVC_HINT_COMP_QUALITY)) while (quality > 10 && UVC_NEED() > capacity) quality -= 5;
+        hint &= fcc == V4L2_PIX_FMT_MJPEG ? 0 : UVC_HINT_COMP_QUALITY;
+    }
+
+    out->bmHint          = req ? req->bmHint : 1;
+    out->dwFrameInterval = *iv;
+    out->wKeyFrameRate   = keyframe;
+    out->wCompQuality    = fcc == V4L2_PIX_FMT_MJPEG ? quality * 100 : 0;
+    out->dwMaxPayloadTransferSize = payload;
+    return UVC_NEED() > capacity ? -1 : 0;
+    #undef UVC_NEED
+}
+
+// a frame that does not fit in the payload the host asked for gets the full endpoint,
+// then the largest smaller frame of the format that fits is taken instead, so a commit
+// never underruns, the host reads back what was settled on with GET_CUR
+static const struct uvc_frame_info*
+uvc_negotiate(struct uvc_device *dev, struct uvc_streaming_control *out, const struct uvc_format_info *format,
+              int iframe, const struct uvc_streaming_control *req)
+{
+    const struct uvc_frame_info *asked = &format->frames[iframe], *frame = asked;
+    unsigned int payload = dev->maxpayload;
+    int          ret;
+
+    if (req && req->dwMaxPayloadTransferSize && req->dwMaxPayloadTransferSize < payload) {
+        ret = uvc_negotiate_mode(dev, out, format->fcc, frame, req, req->dwMaxPayloadTransferSize);
+        if (ret == 0) goto done;
+    }
+    while ((ret = uvc_negotiate_mode(dev, out, format->fcc, frame, req, payload)) < 0 && iframe > 0) {
+        frame = &format->frames[--iframe];
+    }
+    if (ret < 0) {
+        printf("no %.4s frame fits the %lld B/s the endpoint carries !\n", (char*)&format->fcc,
+               (long long)uvc_link_capacity(dev, payload));
+    } else if (frame != asked) {
+        printf("%.4s %ux%u does not fit the endpoint, %ux%u instead\n", (char*)&format->fcc,
+               asked->width, asked->height, frame->width, frame->height);
+    }
+done:
+    out->bFrameIndex         = iframe + 1;
+    out->dwMaxVideoFrameSize = uvc_max_frame_size(format->fcc, frame->width, frame->height);
+    return frame;
+}
+
 static void
 uvc_fill_streaming_control(struct uvc_device *dev,
                            struct uvc_streaming_control *ctrl,
                            int iframe, int iformat)
 {
     const struct uvc_format_info *format;
-    const struct uvc_frame_info  *frame ;
     unsigned int nframes;
 
     if (iformat < 0) iformat = ARRAY_SIZE(uvc_formats) + iformat;
@@ -406,28 +1164,10 @@ uvc_fill_streaming_control(struct uvc_device *dev,
 
     if (iframe < 0) iframe = nframes + iframe;
     if (iframe < 0 || iframe >= (int)nframes) return;
-    frame = &format->frames[iframe];
 
     memset(ctrl, 0, sizeof(*ctrl));
-    ctrl->bmHint          = 1;
     ctrl->bFormatIndex    = iformat + 1;
-    ctrl->bFrameIndex     = iframe  + 1;
-    ctrl->dwFrameInterval = frame->intervals[0];
-    switch (format->fcc) {
-    case V4L2_PIX_FMT_NV12:
-        ctrl->dwMaxVideoFrameSize = frame->width * frame->height * 1.5;
-        break;
-    case V4L2_PIX_FMT_MJPEG:
-        ctrl->dwMaxVideoFrameSize = frame->width * frame->height * 1.5 / 3;
-        break;
-    case v4l2_fourcc('H','2','6','4'):
-        ctrl->dwMaxVideoFrameSize = frame->width * frame->height * 1.5 / 4;
-        break;
-    case v4l2_fourcc('H','2','6','5'):
-        ctrl->dwMaxVideoFrameSize = frame->width * frame->height * 1.5 / 5;
-        break;
-    }
-    ctrl->dwMaxPayloadTransferSize = 1024; /* TODO this should be filled by the driver. */
+    uvc_negotiate(dev, ctrl, format, iframe, NULL);
     ctrl->bmFramingInfo    = 3;
     ctrl->bPreferedVersion = 1;
     ctrl->bMaxVersion      = 1;
@@ -443,11 +1183,18 @@ uvc_events_process_standard(struct uvc_device *dev, struct usb_ctrlrequest *ctrl
     (void)resp;
 }
 
+// dev->control while an extension unit SET_CUR waits for its data stage
+#define UVC_XU_CONTROL 0x100
+
 static void
-uvc_events_process_control(struct uvc_device *dev, uint8_t req, uint8_t cs,
+uvc_events_process_control(struct uvc_device *dev, uint8_t unit, uint8_t req, uint8_t cs,
                            struct uvc_request_data *resp)
 {
-    printf("control request (req %02x cs %02x)\n", req, cs);
+    printf("control request (unit %02x req %02x cs %02x)\n", unit, req, cs);
+    if (dev->xu && uvc_xu_setup(dev->xu, unit, req, cs, resp)) {
+        if (req == UVC_SET_CUR && resp->length > 0) dev->control = UVC_XU_CONTROL;
+        return;
+    }
     //++ do not remove these code
     if (resp->length < 0) {
         resp->data[0] = 0x5;
@@ -511,7 +1258,7 @@ uvc_events_process_class(struct uvc_device *dev, struct usb_ctrlrequest *ctrl,
 
     switch (ctrl->wIndex & 0xff) {
     case UVC_INTF_CONTROL:
-        uvc_events_process_control(dev, ctrl->bRequest, ctrl->wValue >> 8, resp);
+        uvc_events_process_control(dev, ctrl->wIndex >> 8, ctrl->bRequest, ctrl->wValue >> 8, resp);
         break;
     case UVC_INTF_STREAMING:
         uvc_events_process_streaming(dev, ctrl->bRequest, ctrl->wValue >> 8, resp);
@@ -546,7 +1293,6 @@ uvc_events_process_data(struct uvc_device *dev, struct uvc_request_data *data)
     struct uvc_streaming_control *ctrl;
     const struct uvc_format_info *format;
     const struct uvc_frame_info  *frame;
-    const unsigned int *interval;
     unsigned int iformat, iframe;
     unsigned int nframes;
 
@@ -554,11 +1300,15 @@ uvc_events_process_data(struct uvc_device *dev, struct uvc_request_data *data)
     case UVC_VS_PROBE_CONTROL:
         printf("setting probe control, length = %d\n", data->length);
         target = &dev->probe;
+        uvc_ttff_mark(dev, TTFF_PROBE);
         break;
     case UVC_VS_COMMIT_CONTROL:
         printf("setting commit control, length = %d\n", data->length);
         target = &dev->commit;
         break;
+    case UVC_XU_CONTROL:
+        uvc_xu_data(dev->xu, data);
+        return;
     default:
         printf("setting unknown control, length = %d\n", data->length);
         return;
@@ -575,29 +1325,9 @@ uvc_events_process_data(struct uvc_device *dev, struct uvc_request_data *data)
     }
 
     iframe   = clamp((unsigned int)ctrl->bFrameIndex, 1U, nframes);
-    frame    = &format->frames[iframe-1];
-    interval = frame->intervals;
-    while (interval[0] < ctrl->dwFrameInterval && interval[1]) {
-        ++interval;
-    }
 
     target->bFormatIndex = iformat;
-    target->bFrameIndex  = iframe;
-    switch (format->fcc) {
-    case V4L2_PIX_FMT_NV12:
-        target->dwMaxVideoFrameSize = frame->width * frame->height * 1.5;
-        break;
-    case V4L2_PIX_FMT_MJPEG:
-        target->dwMaxVideoFrameSize = frame->width * frame->height * 1.5 / 3;
-        break;
-    case v4l2_fourcc('H','2','6','4'):
-        target->dwMaxVideoFrameSize = frame->width * frame->height * 1.5 / 4;
-        break;
-    case v4l2_fourcc('H','2','6','5'):
-        target->dwMaxVideoFrameSize = frame->width * frame->height * 1.5 / 5;
-        break;
-    }
-    target->dwFrameInterval = *interval;
+    frame = uvc_negotiate(dev, target, format, iframe - 1, ctrl);
 
     if (dev->control == UVC_VS_COMMIT_CONTROL) {
         dev->fcc     = format->fcc;
@@ -605,33 +1335,65 @@ uvc_events_process_data(struct uvc_device *dev, struct uvc_request_data *data)
         dev->height  = frame->height;
         dev->vfrate  = ((int)(1.0/target->dwFrameInterval*10000000));
         dev->maxfsize= target->dwMaxVideoFrameSize;
+        dev->cquality= target->wCompQuality ? target->wCompQuality / 100 : dev->quality;
         switch (dev->fcc) {
         case v4l2_fourcc('H','2','6','4'):
-            switch (dev->width) {
-            case 1920: dev->vibrate = 3000*1000; break;
-            case 1280: dev->vibrate = 2000*1000; break;
-            default  : dev->vibrate = 1000*1000; break;
-            }
-            break;
         case v4l2_fourcc('H','2','6','5'):
-            switch (dev->width) {
-            case 1920: dev->vibrate = 3000*1000; break;
-            case 1280: dev->vibrate = 2000*1000; break;
-            default  : dev->vibrate = 1000*1000; break;
+            // leave a fifth of the link for key frame bursts
+            dev->vibrate = uvc_default_bitrate(dev->width);
+            if (dev->vibrate > uvc_link_capacity(dev, target->dwMaxPayloadTransferSize) * 8 * 4 / 5) {
+                dev->vibrate = uvc_link_capacity(dev, target->dwMaxPayloadTransferSize) * 8 * 4 / 5;
             }
             break;
         case V4L2_PIX_FMT_MJPEG:
             break;
         case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
             break;
         }
-        uvc_video_set_format(dev);
+        uvc_gather_reset(&dev->gather, dev->fcc);
+        // buffers kept over a reconnect are reused when they suit the new commit
+        if (dev->nbufs && !dev->streamon && (dev->bfcc != dev->fcc || dev->bwidth != dev->width || dev->bheight != dev->height)) {
+            uvc_video_reqbufs(dev, 0);
+        }
+        if (!dev->nbufs) uvc_video_set_format(dev);
+        uvc_video_prepare(dev);
+        uvc_ttff_mark(dev, TTFF_COMMIT);
         if (dev->bulk) {
             uvc_video_stream(dev, 1);
         }
     }
 }
 
+static void
+uvc_events_connect(struct uvc_device *dev)
+{
+    printf("host connected.\n");
+    uvc_fill_streaming_control(dev, &dev->probe , 0, 0);
+    uvc_fill_streaming_control(dev, &dev->commit, 0, 0);
+    dev->control = 0;
+    // after a re-enumeration the startup report covers connect to first frame
+    if (dev->ttff[TTFF_QBUF]) {
+        memset(dev->ttff, 0, sizeof(dev->ttff));
+        dev->tinit = uvc_clock_ns();
+    }
+}
+
+// the stream is parked but the buffers stay mapped, a host that comes back with the
+// same commit goes straight to queueing them
+static void
+uvc_events_disconnect(struct uvc_device *dev)
+{
+    struct uvc_device *src = dev->owner ? dev->owner : dev;
+
+    printf("host disconnected.\n");
+    if (dev->streamon) uvc_video_stream(dev, 0);
+    // in dispatch mode nothing fills from the frame read last either, the capture
+    // thread hands that one back itself once it has nothing to stream for
+    if (src->push && !uvc_video_active(src)) uvc_push_flush(src->push, !!(src->flags & CAMUVC_INIT_NOTHREAD));
+}
+
 static void
 uvc_events_process(struct uvc_device *dev)
 {
@@ -640,7 +1402,9 @@ uvc_events_process(struct uvc_device *dev)
     struct uvc_request_data resp;
     int    ret;
 
+    UVC_TRACE_BEGIN("dqevent");
     ret = ioctl(dev->fd, VIDIOC_DQEVENT, &v4l2_event);
+    UVC_TRACE_END("dqevent");
     if (ret < 0) {
         printf("VIDIOC_DQEVENT failed: %s (%d)\n", strerror(errno), errno);
         return;
@@ -651,18 +1415,25 @@ uvc_events_process(struct uvc_device *dev)
 
     switch (v4l2_event.type) {
     case UVC_EVENT_CONNECT:
+        uvc_events_connect(dev);
+        return;
     case UVC_EVENT_DISCONNECT:
+        uvc_events_disconnect(dev);
         return;
     case UVC_EVENT_SETUP:
+        UVC_TRACE_BEGIN("setup");
         uvc_events_process_setup(dev, &uvc_event->req, &resp);
+        UVC_TRACE_END("setup");
         break;
     case UVC_EVENT_DATA:
+        UVC_TRACE_BEGIN("data");
         uvc_events_process_data(dev, &uvc_event->data);
+        UVC_TRACE_END("data");
         return;
     case UVC_EVENT_STREAMON:
-        uvc_video_reqbufs(dev, 3);
+        uvc_ttff_mark(dev, TTFF_STREAMON);
+        if (!dev->nbufs) uvc_video_reqbufs(dev, 3);
         uvc_video_stream (dev, 1);
-        dev->status |= FLAG_REQUEST_IDR;
         return;
     case UVC_EVENT_STREAMOFF:
         uvc_video_stream (dev, 0);
@@ -683,10 +1454,6 @@ uvc_events_init(struct uvc_device *dev)
     struct v4l2_event_subscription sub;
     uvc_fill_streaming_control(dev, &dev->probe , 0, 0);
     uvc_fill_streaming_control(dev, &dev->commit, 0, 0);
-    if (dev->bulk) {
-        dev->probe .dwMaxPayloadTransferSize = 16 * 1024;
-        dev->commit.dwMaxPayloadTransferSize = 16 * 1024;
-    }
 
     memset(&sub, 0, sizeof sub);
     sub.type = UVC_EVENT_SETUP;      ioctl(dev->fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
@@ -699,83 +1466,443 @@ uvc_events_init(struct uvc_device *dev)
     sub.type = UVC_EVENT_LAST;       ioctl(dev->fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
 }
 
+// each wakeup takes back every finished buffer, then refills and queues what it can
+// from the frame on offer, a buffer without a frame stays idle until the next one
 static void* camuvc_process_proc(void *argv)
 {
     struct uvc_device *dev = (struct uvc_device*)argv;
-    fd_set fds;
-    int    ret;
+    struct pollfd pfds[2];
+    uint64_t      cnt;
+    int           ret;
 
-    FD_ZERO(&fds);
-    FD_SET(dev->fd, &fds);
+    pfds[0].fd     = dev->fd;
+    pfds[1].fd     = dev->vfd;
+    pfds[1].events = POLLIN;
     while (!(dev->status & FLAG_EXIT_ALL)) {
-        struct timeval tv;
-        fd_set efds = fds;
-        fd_set wfds = fds;
-        tv.tv_sec   = 1;
-        tv.tv_usec  = 0;
-        ret = select(dev->fd + 1, NULL, &wfds, &efds, &tv);
+        pfds[0].events  = uvc_video_poll_events(dev);
+        pfds[0].revents = pfds[1].revents = 0;
+        ret = poll(pfds, 2, 1000);
         if (ret == -1) {
-            printf("select error !\n");
+            if (errno == EINTR) continue;
+            printf("poll error !\n");
             break;
         }
-        if (ret ==  0) {
-//          printf("select timeout !\n");
-            continue;
-        }
-        if (FD_ISSET(dev->fd, &efds)) {
-//          printf("uvc_events_process\n");
+        if (pfds[0].revents & POLLPRI) {
             uvc_events_process(dev);
         }
-        if (FD_ISSET(dev->fd, &wfds)) {
-//          printf("uvc_video_process\n");
-            uvc_video_process(dev);
+        if (pfds[0].revents & (POLLOUT | POLLERR)) {
+            // an error with nothing to take back, the queue is not streaming
+            if (!uvc_video_reclaim(dev, dev->nbufs) && (pfds[0].revents & POLLERR)) usleep(100*1000);
+        }
+        if (pfds[1].revents & POLLIN) {
+            if (read(dev->vfd, &cnt, sizeof(cnt)) < 0) {}
         }
+        if (dev->streamon && dev->nidle) uvc_video_refill(dev);
     }
 
     return NULL;
 }
 
-void* camuvc_init(char *devname)
+void* camuvc_init_ex(char *devname, int flags)
 {
     struct uvc_device *dev;
-    int    bulk_mode = 0;
+    int64_t tinit     = uvc_clock_ns();
+    int     bulk_mode = 0;
 
-    dev = uvc_open(devname);
+    dev = uvc_open(devname, flags & CAMUVC_INIT_REOPEN);
     if (dev == NULL) {
         printf("failed to open video device !\n");
         return NULL;
     }
-    dev->bulk = bulk_mode;
+    dev->bulk    = bulk_mode;
+    dev->quality = 80;
+    // the endpoint the gadget was built with, 1024 when nobody can tell
+    dev->maxpayload = bulk_mode ? 16 * 1024 : uvc_gadget_maxpacket("/sys/kernel/config/usb_gadget");
+    if (dev->maxpayload <= 12) dev->maxpayload = 1024;
+    dev->bulkrate   = 40 * 1000 * 1000; // what high speed bulk sustains on a quiet bus
+    dev->flags   = flags;
+    dev->tinit   = tinit;
+    uvc_ttff_mark(dev, TTFF_OPEN);
 
     uvc_events_init(dev);
     uvc_video_init (dev);
+    uvc_ttff_mark(dev, TTFF_SUBSCRIBE);
 
-    // create video encode thread & vvc process thread
-    pthread_create(&dev->encthread, NULL, main_video_capture_proc, dev);
-    pthread_create(&dev->uvcthread, NULL, camuvc_process_proc    , dev);
+    // create video encode thread & vvc process thread, a lazy start leaves the
+    // encode thread to uvc_video_prepare() on the first commit
+    if (!(flags & (CAMUVC_INIT_LAZY | CAMUVC_INIT_NOTHREAD))) pthread_create(&dev->encthread, NULL, main_video_capture_proc, dev);
+    if (!(flags & CAMUVC_INIT_NOTHREAD)) pthread_create(&dev->uvcthread, NULL, camuvc_process_proc, dev);
+    uvc_ttff_mark(dev, TTFF_READY);
     return dev;
 }
 
+void* camuvc_init(char *devname)
+{
+    return camuvc_init_ex(devname, 0);
+}
+
 void camuvc_exit(void *ctxt)
 {
     struct uvc_device *dev = (struct uvc_device*)ctxt;
+    struct uvc_device *src;
+    uint64_t cnt = 1;
+    int    i;
     if (!ctxt) return;
 
-    pthread_mutex_lock(&dev->mutex);
+    src = dev->owner ? dev->owner : dev;
+    pthread_mutex_lock(&src->mutex);
     dev->status |= FLAG_EXIT_ALL;
-    pthread_cond_signal(&dev->cond);
-    pthread_mutex_unlock(&dev->mutex);
+    pthread_cond_broadcast(&src->cond);
+    pthread_mutex_unlock(&src->mutex);
+    if (write(dev->vfd, &cnt, sizeof(cnt)) < 0) {}
 
-    // exit video encode thread
-    if (dev->encthread) pthread_join(dev->encthread, NULL);
+    // exit uvc process thread first, it may still start the encode thread
     if (dev->uvcthread) pthread_join(dev->uvcthread, NULL);
+    if (dev->encthread) pthread_join(dev->encthread, NULL);
 
+    if (dev->owner) {
+        pthread_mutex_lock(&src->mutex);
+        // a frame still on offer to us is given back before the capture loses sight of us
+        if (dev->vsem == 1) {
+            dev->vsem = 0;
+            src->vrefs--;
+            pthread_cond_broadcast(&src->cond);
+        }
+        for (i=0; i<src->nfanout && src->fanout[i]!=dev; i++);
+        if (i < src->nfanout) src->fanout[i] = src->fanout[--src->nfanout];
+        pthread_mutex_unlock(&src->mutex);
+    }
     uvc_close(dev);
 }
 
+int camuvc_replay(void *ctxt, const char *file, int flags)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || dev->source || (dev->flags & CAMUVC_INIT_NOTHREAD)) return -1;
+    dev->source = uvc_replay_open(file, flags & CAMUVC_REPLAY_FAST);
+    return dev->source ? 0 : -1;
+}
+
+int camuvc_pattern(void *ctxt, int pattern)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || dev->source || (dev->flags & CAMUVC_INIT_NOTHREAD)) return -1;
+    dev->source = uvc_pattern_open(pattern & ~CAMUVC_PATTERN_FAST, pattern & CAMUVC_PATTERN_FAST);
+    return dev->source ? 0 : -1;
+}
+
+int camuvc_capture(void *ctxt, const char *devname)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !devname || dev->source || (dev->flags & CAMUVC_INIT_NOTHREAD)) return -1;
+    dev->source = uvc_capture_open(devname);
+    return dev->source ? 0 : -1;
+}
+
+int camuvc_xu_control(void *ctxt, int unit, int cs, int size,
+                      int (*get)(void *priv, int unit, int cs, uint8_t *data, int size),
+                      int (*set)(void *priv, int unit, int cs, const uint8_t *data, int size), void *priv)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt) return -1;
+    if (!dev->xu && !(dev->xu = uvc_xu_create(2))) return -1;
+    return uvc_xu_add(dev->xu, unit, cs, size, get, set, priv);
+}
+
+int camuvc_shm_serve(void *ctxt, const char *path, int nslots, int slotsize)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || dev->source || (dev->flags & CAMUVC_INIT_NOTHREAD)) return -1;
+    dev->source = uvc_shm_open(path, nslots, slotsize);
+    return dev->source ? 0 : -1;
+}
+
+int camuvc_producer_open(void *ctxt, int depth)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || dev->source) return -1;
+    dev->source = dev->push = uvc_push_open(depth);
+    return dev->source ? 0 : -1;
+}
+
+int camuvc_push(void *ctxt, const struct camuvc_frame *frame,
+                void (*release)(void *opaque, const struct camuvc_frame *frame), void *opaque, int timeout)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    int ret;
+    if (!ctxt || !dev->push || !frame) return -1;
+    UVC_TRACE_BEGIN("push");
+    ret = uvc_push_frame(dev->push, frame, release, opaque, timeout);
+    UVC_TRACE_END("push");
+    return ret;
+}
+
+int camuvc_producer_fd(void *ctxt)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    return ctxt && dev->push ? uvc_push_fd(dev->push) : -1;
+}
+
+int camuvc_producer_queued(void *ctxt, int *depth)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    return ctxt && dev->push ? uvc_push_queued(dev->push, depth) : -1;
+}
+
+int camuvc_set_encoder(void *ctxt, const struct camuvc_venc_ops *ops, void *priv, int maxsess)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || dev->venc || (dev->flags & CAMUVC_INIT_NOTHREAD)) return -1;
+    dev->venc_ops  = ops;
+    dev->venc_priv = priv;
+    dev->venc      = uvc_venc_create(ops, priv, maxsess);
+    return dev->venc ? 0 : -1;
+}
 
+int camuvc_set_bitrate_range(void *ctxt, int minbps, int maxbps)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || minbps < 0 || maxbps < minbps) return -1;
+    dev->minbps = minbps;
+    dev->maxbps = maxbps;
+    return 0;
+}
 
+int camuvc_record_start(void *ctxt, const char *path, int64_t segbytes, int bufsize)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    struct uvc_record *rec;
+    if (!ctxt || !path) return -1;
+
+    if (!(rec = uvc_record_open(path, segbytes, bufsize))) return -1;
+    pthread_mutex_lock(&dev->recmutex);
+    if (dev->record) {
+        pthread_mutex_unlock(&dev->recmutex);
+        uvc_record_close(rec);
+        return -1;
+    }
+    dev->record = rec;
+    pthread_mutex_unlock(&dev->recmutex);
+    return 0;
+}
 
+int camuvc_record_stop(void *ctxt)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    struct uvc_record *rec;
+    if (!ctxt) return -1;
+
+    pthread_mutex_lock(&dev->recmutex);
+    rec = dev->record;
+    dev->record = NULL;
+    pthread_mutex_unlock(&dev->recmutex);
+    return rec ? uvc_record_close(rec) : -1;
+}
+
+int camuvc_set_governor(void *ctxt, int budget, int flags)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || budget < 0 || budget > 100) return -1;
+    dev->gbudget = budget;
+    dev->gflags  = flags;
+    return 0;
+}
 
+int64_t camuvc_clock_ns(void)
+{
+    return uvc_clock_ns();
+}
 
+int camuvc_audio_open(void *ctxt, const char *sink, int rate, int channels, int period)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || dev->audio) return -1;
+    dev->audio = uvc_audio_open(sink, rate, channels, period);
+    return dev->audio ? 0 : -1;
+}
 
+int camuvc_audio_write(void *ctxt, const int16_t *pcm, int frames, int64_t pts)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !dev->audio || frames < 0) return -1;
+    return uvc_audio_write(dev->audio, pcm, frames, pts);
+}
+
+int camuvc_gadget_setup(const char *root, const char *name, const char *udc, int flags)
+{
+    const struct uvc_frame_info *frame;
+    struct uvc_gadget *g;
+    unsigned int i, n;
+
+    g = uvc_gadget_open(root ? root : "/sys/kernel/config/usb_gadget", name ? name : "camuvc", flags);
+    if (!g) return -1;
+    for (n=0; n<((flags & CAMUVC_GADGET_DUAL) ? 2 : 1); n++) {
+        uvc_gadget_function(g);
+        for (i=0; i<ARRAY_SIZE(uvc_formats); i++) {
+            uvc_gadget_format(g, uvc_formats[i].fcc);
+            for (frame=uvc_formats[i].frames; frame->width; frame++) {
+                uvc_gadget_frame(g, frame->width, frame->height,
+                    uvc_max_frame_size(uvc_formats[i].fcc, frame->width, frame->height), frame->intervals);
+            }
+        }
+    }
+    return uvc_gadget_close(g, udc);
+}
+
+int camuvc_startup_report(void *ctxt, char *buf, int size)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !buf || size <= 0) return -1;
+    return uvc_ttff_report(dev, buf, size);
+}
+
+int camuvc_set_max_payload(void *ctxt, int bytes)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || bytes <= 12) return -1;
+    dev->maxpayload = bytes;
+    uvc_fill_streaming_control(dev, &dev->probe , 0, 0);
+    uvc_fill_streaming_control(dev, &dev->commit, 0, 0);
+    return 0;
+}
+
+int camuvc_set_bulk_rate(void *ctxt, int bytes)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || bytes <= 0) return -1;
+    dev->bulkrate = bytes;
+    uvc_fill_streaming_control(dev, &dev->probe , 0, 0);
+    uvc_fill_streaming_control(dev, &dev->commit, 0, 0);
+    return 0;
+}
+
+int camuvc_repeat_param_sets(void *ctxt, int on)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt) return -1;
+    dev->gather.repeat = on;
+    return 0;
+}
+
+static struct uvc_osd*
+uvc_video_osd(struct uvc_device *dev)
+{
+    if (!dev->osd) dev->osd = uvc_osd_create();
+    return dev->osd;
+}
+
+int camuvc_osd_text(void *ctxt, int layer, int x, int y, int scale, uint32_t fg, uint32_t bg, const char *text)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !text || !uvc_video_osd(dev)) return -1;
+    return uvc_osd_text(dev->osd, layer, x, y, scale, fg, bg, text);
+}
+
+int camuvc_osd_bitmap(void *ctxt, int layer, int x, int y, int w, int h, const uint8_t *rgba)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !uvc_video_osd(dev)) return -1;
+    return uvc_osd_bitmap(dev->osd, layer, x, y, w, h, rgba);
+}
+
+int camuvc_osd_mask(void *ctxt, int layer, int x, int y, int w, int h, uint32_t color)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !uvc_video_osd(dev)) return -1;
+    return uvc_osd_mask(dev->osd, layer, x, y, w, h, color);
+}
+
+int camuvc_osd_clear(void *ctxt, int layer)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt || !dev->osd) return -1;
+    return uvc_osd_clear(dev->osd, layer);
+}
+
+// fill one idle buffer from the producer queue, returns 1 if a buffer went out
+static int
+uvc_dispatch_frame(struct uvc_device *dev)
+{
+    struct camuvc_frame frame;
+    struct v4l2_buffer  buf;
+
+    if (!dev->push || uvc_push_queued(dev->push, NULL) <= 0) return 0;
+    memset(&frame, 0, sizeof(frame));
+    if (dev->push->read(dev->push, &frame) < 0) return 0;
+    // a dropped frame is work done too, the buffer waits for the next one
+    dev->gread = 0;
+    if (uvc_govern_skip(&dev->govern)) return 1;
+    // the same check uvc_video_submit() does, a frame of another format would be
+    // read as if it were the committed one
+    if (!frame.fcc) frame.fcc = dev->fcc;
+    if (frame.fcc != dev->fcc && !(frame.fcc == V4L2_PIX_FMT_NV12 && uvc_video_from_nv12(dev->fcc))) return 1;
+
+    pthread_mutex_lock(&dev->mutex);
+    uvc_video_offer(dev, dev, &frame);
+    pthread_mutex_unlock(&dev->mutex);
+
+    memset(&buf, 0, sizeof buf);
+    buf.index  = dev->idle[--dev->nidle];
+    buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_MMAP;
+    UVC_TRACE_BEGIN("fill_buffer");
+    uvc_video_fill_buffer(dev, &buf);
+    UVC_TRACE_END("fill_buffer");
+    if (uvc_video_queue(dev, &buf) < 0) {
+        dev->idle[dev->nidle++] = buf.index;
+        return 0;
+    }
+    uvc_ttff_mark(dev, TTFF_QBUF);
+    return 1;
+}
+
+int camuvc_fd(void *ctxt, int *events)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    if (!ctxt) return -1;
+    if (events) *events = uvc_video_poll_events(dev);
+    return dev->fd;
+}
+
+int camuvc_dispatch(void *ctxt, int budget)
+{
+    struct uvc_device *dev = (struct uvc_device*)ctxt;
+    struct pollfd      pfd;
+    int    n, k;
+
+    if (!ctxt || !(dev->flags & CAMUVC_INIT_NOTHREAD)) return -1;
+    for (n=0; n<budget; n++) {
+        pfd.fd      = dev->fd;
+        pfd.events  = uvc_video_poll_events(dev);
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) < 0) return -1;
+        if (pfd.revents & POLLPRI) {
+            uvc_events_process(dev);
+        } else if (pfd.revents & POLLOUT) {
+            // every reclaimed buffer counts against the budget
+            if (!(k = uvc_video_reclaim(dev, budget - n))) break;
+            n += k - 1;
+        } else if (!dev->nidle || !uvc_dispatch_frame(dev)) {
+            break;
+        }
+    }
+    return n;
+}
+
+int camuvc_attach(void *primary, void *secondary)
+{
+    struct uvc_device *dev = (struct uvc_device*)primary;
+    struct uvc_device *sec = (struct uvc_device*)secondary;
+    if (!dev || !sec || dev == sec || dev->owner || sec->owner || sec->nfanout) return -1;
+    if ((dev->flags | sec->flags) & CAMUVC_INIT_NOTHREAD) return -1;
+
+    pthread_mutex_lock(&dev->mutex);
+    if (dev->nfanout == UVC_MAX_FANOUT) {
+        pthread_mutex_unlock(&dev->mutex);
+        return -1;
+    }
+    sec->owner = dev;
+    dev->fanout[dev->nfanout++] = sec;
+    pthread_mutex_unlock(&dev->mutex);
+    return 0;
+}
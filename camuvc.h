@@ -1,8 +1,230 @@
 #ifndef __CAMUVC_H__
 #define __CAMUVC_H__
 
+#include <stdint.h>
+#include <sys/uio.h>
+
+// one picture or encoded frame, data stays owned by whoever produced it
+struct camuvc_frame {
+    uint8_t     *data;
+    int          len;
+    unsigned int fcc;    // 0: same as the committed format
+    int          width;  // 0: committed size
+    int          height;
+    int          yoff;   // nv12 plane offsets into data
+    int          uoff;
+    const struct iovec *iov; // encoded frames may come in pieces instead of data/len,
+    int          iovcnt;     // gathered into the gadget buffer in one pass
+};
+
+// build the uvc gadget in configfs straight from the library's format table and bind it
+// to udc (NULL: the first one), call before camuvc_init(), root NULL means
+// /sys/kernel/config/usb_gadget, with CAMUVC_GADGET_DRYRUN root may be any plain
+// directory and the tree is only written out for inspection
+#define CAMUVC_GADGET_DRYRUN (1 << 0)
+#define CAMUVC_GADGET_BULK   (1 << 1) // needs a vendor kernel with streaming_bulk
+#define CAMUVC_GADGET_UAC1   (1 << 2) // add a uac1 function for camuvc_audio_open()
+#define CAMUVC_GADGET_DUAL   (1 << 3) // two uvc functions, for camuvc_attach()
+int   camuvc_gadget_setup(const char *root, const char *name, const char *udc, int flags);
+
 void* camuvc_init(char *devname);
 void  camuvc_exit(void *ctxt   );
 
-#endif
+// CAMUVC_INIT_LAZY defers the encode thread and format specific setup to the first
+// commit, CAMUVC_INIT_REOPEN keeps the open/close/open of the video node for
+// gadget drivers that need it
+#define CAMUVC_INIT_LAZY     (1 << 0)
+#define CAMUVC_INIT_REOPEN   (1 << 1)
+#define CAMUVC_INIT_NOTHREAD (1 << 2) // no threads of its own, see camuvc_dispatch()
+void* camuvc_init_ex(char *devname, int flags);
+
+// time to first frame, per phase from camuvc_init() to the first buffer queued with
+// a real frame, also printed once when that happens, returns the length written
+int   camuvc_startup_report(void *ctxt, char *buf, int size);
+
+// CAMUVC_INIT_NOTHREAD: the library runs inside the caller's event loop. Wait on the
+// fd returned by camuvc_fd() for the poll events it reports (re-read them after every
+// dispatch) and push frames with camuvc_push(..., 0) when camuvc_producer_fd() is
+// readable, camuvc_dispatch() then does at most budget units of non-blocking work,
+// an event, a buffer reclaimed or a frame queued, and returns how many it did. Frames
+// only come through camuvc_push() in this mode, the built-in sources and the encoder
+// hook have no thread to run on and are refused
+int   camuvc_fd      (void *ctxt, int *events);
+int   camuvc_dispatch(void *ctxt, int budget);
+
+// feed the stream of secondary, a second uvc function with its own camuvc_init(), from
+// the capture of primary, both read each frame in place. The secondary takes NV12
+// frames as NV12 or MJPEG at its own size, and compressed frames only when it committed
+// the same format and size. Frames it is too busy to take are skipped, but a frame it
+// took holds the capture until it is filled, so a slow secondary can lower the
+// primary's frame rate. While the primary is off the capture runs in the format of
+// the first secondary streaming. Up to three secondaries per primary; call
+// camuvc_exit() on each secondary before the primary.
+int   camuvc_attach(void *primary, void *secondary);
+
+// replay a recorded H.264/H.265 Annex-B or MJPEG file as the frame source,
+// call once right after camuvc_init(), the file loops until camuvc_exit()
+#define CAMUVC_REPLAY_FAST (1 << 0) // ignore the committed frame interval
+int   camuvc_replay(void *ctxt, const char *file, int flags);
+
+// built-in test patterns as the frame source, drawn at the committed size for NV12,
+// YUY2/UYVY and MJPEG streams, call once right after camuvc_init(). With
+// CAMUVC_PATTERN_COUNTER the top 32 rows carry the frame number, starting at 0 on
+// every stream start, camuvc_pattern_counter() reads it back from an uncompressed
+// frame or returns -1, so a host side check sees drops and repeats
+#define CAMUVC_PATTERN_BARS    0
+#define CAMUVC_PATTERN_RAMP    1
+#define CAMUVC_PATTERN_NOISE   2
+#define CAMUVC_PATTERN_COUNTER (1 << 8)
+#define CAMUVC_PATTERN_FAST    (1 << 9) // ignore the committed frame interval
+int   camuvc_pattern(void *ctxt, int pattern);
+int64_t camuvc_pattern_counter(const uint8_t *data, unsigned int fcc, int width, int height);
+
+// a V4L2 capture node (sensor, ISP, vivid, v4l2loopback) as the frame source, on every
+// stream start it is set to the committed format and size, or to NV12 at the nearest
+// size it offers when the stream is built from NV12 (NV12, YUY2/UYVY, MJPEG). Frames
+// are read in place from the capture buffers mapped from the node, call once right
+// after camuvc_init()
+int   camuvc_capture(void *ctxt, const char *devname);
+
+// in-process producer, frames queue up to depth deep by reference and are read in place,
+// release(opaque, frame) hands each one back once it went out or was flushed on a new
+// stream. camuvc_push() waits up to timeout ms for room (0: try, -1: forever) and fails
+// with errno EAGAIN when there is none, a wait cut short by camuvc_exit() fails with
+// EPIPE before camuvc_exit() returns. The fd is readable while a push would not block,
+// camuvc_producer_queued() returns how many frames wait and the depth
+int   camuvc_producer_open  (void *ctxt, int depth);
+int   camuvc_push           (void *ctxt, const struct camuvc_frame *frame,
+                             void (*release)(void *opaque, const struct camuvc_frame *frame), void *opaque, int timeout);
+int   camuvc_producer_fd    (void *ctxt);
+int   camuvc_producer_queued(void *ctxt, int *depth);
+
+// frames from another process through a memfd ring of nslots slots of slotsize bytes,
+// producers find it through the unix socket at path, call once right after camuvc_init()
+int   camuvc_shm_serve(void *ctxt, const char *path, int nslots, int slotsize);
+
+// producer side: acquire a free slot, write the frame into it in place and commit it,
+// frame->data is not used on commit, offsets are relative to the slot.
+// camuvc_shm_format() reports the committed format and returns 1 when it changed
+struct camuvc_shm;
+struct camuvc_shm* camuvc_shm_connect   (const char *path);
+void               camuvc_shm_disconnect(struct camuvc_shm *shm);
+uint8_t*           camuvc_shm_acquire   (struct camuvc_shm *shm, int *size, int timeout); // ms, -1 waits, NULL when full
+int                camuvc_shm_commit    (struct camuvc_shm *shm, const struct camuvc_frame *frame);
+int                camuvc_shm_format    (struct camuvc_shm *shm, unsigned int *fcc, int *width, int *height);
+
+// platform video encoder, sessions are kept open and cached per format so that
+// a host re-committing a known format only costs an IDR frame
+struct camuvc_venc_params {
+    unsigned int fcc;
+    int          width;
+    int          height;
+    int          interval; // 100ns units, as in dwFrameInterval
+    int          bitrate;
+};
+
+#define CAMUVC_VENC_INTERVAL (1 << 0)
+#define CAMUVC_VENC_BITRATE  (1 << 1)
 
+struct camuvc_venc_ops {
+    void* (*open    )(void *priv, const struct camuvc_venc_params *params);
+    int   (*reconfig)(void *priv, void *sess, const struct camuvc_venc_params *params, int changed);
+    void  (*pause   )(void *priv, void *sess, int pause); // optional, idle sessions are paused
+    void  (*idr     )(void *priv, void *sess);
+    int   (*read    )(void *priv, void *sess, struct camuvc_frame *frame); // frame stays valid until the next read
+    void  (*close   )(void *priv, void *sess);
+};
+
+// call once right after camuvc_init(), maxsess bounds how many sessions stay open
+int   camuvc_set_encoder(void *ctxt, const struct camuvc_venc_ops *ops, void *priv, int maxsess);
+
+// let H.264/H.265 bitrate follow what the host actually drains, within [minbps, maxbps],
+// changes reach the encoder through ops->reconfig with CAMUVC_VENC_BITRATE, maxbps 0 disables
+int   camuvc_set_bitrate_range(void *ctxt, int minbps, int maxbps);
+
+// record what the host receives of an MJPEG, H.264 or H.265 stream into segment files,
+// path is a printf pattern with exactly one %d for the segment number and %% for a
+// literal %, anything else fails. A segment ends at the first key frame after segbytes
+// (0: a single file) and every segment starts with a key frame and its parameter sets.
+// Frames are copied into a ring of bufsize bytes (0: 8 MB) and written by a thread of
+// its own through io_uring, or pwrite where io_uring is not available, so storage never
+// holds up streaming: with the ring full frames are left out of the recording up to the
+// next key frame. camuvc_record_stop() waits until the queued frames are written and
+// returns how many were left out
+int   camuvc_record_start(void *ctxt, const char *path, int64_t segbytes, int bufsize);
+int   camuvc_record_stop (void *ctxt);
+
+// load governor, when building a frame costs more than budget percent of the frame
+// interval, or frames come out late while it costs a good part of it, the stream
+// steps down through the fallbacks in flags: 3/4, 2/3, 1/2, then 1/3 of the committed
+// frame rate, then 75% and 50% of the bitrate, and steps back up once the level above
+// would fit again. GOVERN_FPS runs paced sources (replay, pattern) and encoders with
+// reconfig at the longer interval, GOVERN_SKIP drops frames evenly where that does not
+// apply and never for H.264/H.265, GOVERN_BITRATE needs an encoder with reconfig.
+// budget 0 disables it, takes effect on the next stream start
+#define CAMUVC_GOVERN_FPS     (1 << 0)
+#define CAMUVC_GOVERN_SKIP    (1 << 1)
+#define CAMUVC_GOVERN_BITRATE (1 << 2)
+int   camuvc_set_governor(void *ctxt, int budget, int flags);
+
+// bytes the streaming endpoint moves per microframe, the gadget's streaming_maxpacket
+// times its mult, call right after camuvc_init(), probe/commit only settle on modes
+// that fit. Defaults to what camuvc_gadget_setup() wrote, else what the bound uvc
+// gadget in configfs carries, else 1024
+int   camuvc_set_max_payload(void *ctxt, int bytes);
+
+// bytes per second a bulk streaming endpoint is counted on to move, bulk gets no
+// reserved bandwidth so this is a guess, lower it on a shared bus. Defaults to
+// 40000000, what high speed bulk sustains on a quiet bus
+int   camuvc_set_bulk_rate(void *ctxt, int bytes);
+
+// put the last H.264/H.265 parameter sets seen in the stream in front of IDR frames
+// that come without them, so hosts that start reading late can still decode
+int   camuvc_repeat_param_sets(void *ctxt, int on);
+
+// overlays burned into what the library builds from NV12 (NV12, YUY2/UYVY and MJPEG
+// streams), layers 0..7 are drawn in order, colors are 0xAAYYUUVV, rgba is w x h
+// bytes r,g,b,a and may be freed on return, positions snap to even pixels. Layers
+// are rendered once when set, a text of the same length only redraws the characters
+// that changed, each frame blends just the area the layers cover
+int   camuvc_osd_text  (void *ctxt, int layer, int x, int y, int scale, uint32_t fg, uint32_t bg, const char *text);
+int   camuvc_osd_bitmap(void *ctxt, int layer, int x, int y, int w, int h, const uint8_t *rgba);
+int   camuvc_osd_mask  (void *ctxt, int layer, int x, int y, int w, int h, uint32_t color);
+int   camuvc_osd_clear (void *ctxt, int layer);
+
+// vendor extension unit control cs of the extension unit with bUnitID unit, size bytes
+// long (up to 60), call right after camuvc_init(). The handlers run on worker threads
+// and may take as long as they need, the event thread never waits for them: SET_CUR
+// completes once its data arrived and set() runs afterwards, a SET_CUR while the
+// previous one is still running stalls with "not ready" in the request error code
+// control, a refreshing get() does not hold it up. GET_INFO does not report the
+// control as asynchronous, no status interrupt is sent. GET_CUR answers the value last
+// set, or what the last get() read, and queues a get() to refresh it, a failed set()
+// is read back the same way. The first get() runs right here and also serves GET_DEF.
+// Either handler may be NULL, they return < 0 on failure
+int   camuvc_xu_control(void *ctxt, int unit, int cs, int size,
+                        int (*get)(void *priv, int unit, int cs, uint8_t *data, int size),
+                        int (*set)(void *priv, int unit, int cs, const uint8_t *data, int size), void *priv);
+
+// CLOCK_MONOTONIC in ns, the timebase shared by video pacing and audio pts
+int64_t camuvc_clock_ns(void);
+
+// UAC companion: pcm is s16 interleaved, pumped period by period into sink, which is
+// "hw:card,device" for the gadget's playback pcm or "file:/path" as a stand-in,
+// pts is camuvc_clock_ns() of the first frame (0: contiguous with the previous write),
+// late audio is dropped and early audio waits so it stays in step with video,
+// camuvc_audio_write() never blocks and returns how many frames fit into the ring
+int   camuvc_audio_open (void *ctxt, const char *sink, int rate, int channels, int period);
+int   camuvc_audio_write(void *ctxt, const int16_t *pcm, int frames, int64_t pts);
+
+// process-wide stage tracing (event dequeue, setup, dqbuf/fill/qbuf, producer push),
+// TRACE_MARKER writes atrace style markers into ftrace's trace_marker so a perfetto or
+// trace-cmd capture shows them next to the kernel's usb events, TRACE_MEMORY keeps the
+// last nevents (0: 65536) in memory and camuvc_trace_stop() writes them to file as
+// chrome trace json, when not started the markers cost one predicted branch
+#define CAMUVC_TRACE_MARKER (1 << 0)
+#define CAMUVC_TRACE_MEMORY (1 << 1)
+int   camuvc_trace_start(int flags, int nevents);
+int   camuvc_trace_stop (const char *file);
+
+#endif
@@ -0,0 +1,332 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sound/asound.h>
+#include "uvc_audio.h"
+
+/* ---------------------------------------------------------------------------
+ * Sinks. The UAC gadget shows up as an ALSA card on the device side, it is
+ * driven through the kernel pcm ioctls directly so no alsa-lib is needed.
+ * The file sink stands in for it on machines without the gadget.
+ */
+
+struct audio_sink {
+    int     fd;
+    int     paced;      // writes block on the device clock
+    int     frame_size;
+    int     buffer;     // frames
+};
+
+static void
+alsa_param_mask(struct snd_pcm_hw_params *p, int n, unsigned int bit)
+{
+    struct snd_mask *m = &p->masks[n - SNDRV_PCM_HW_PARAM_FIRST_MASK];
+    memset(m, 0, sizeof(*m));
+    m->bits[bit >> 5] |= 1U << (bit & 31);
+}
+
+static void
+alsa_param_int(struct snd_pcm_hw_params *p, int n, unsigned int val)
+{
+    struct snd_interval *i = &p->intervals[n - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL];
+    i->min     = val;
+    i->max     = val;
+    i->integer = 1;
+}
+
+static int
+alsa_sink_open(struct audio_sink *sk, int card, int device, int rate, int channels, int period)
+{
+    struct snd_pcm_hw_params hw;
+    struct snd_pcm_sw_params sw;
+    char   path[64];
+    int    n, boundary;
+
+    snprintf(path, sizeof(path), "/dev/snd/pcmC%dD%dp", card, device);
+    // non-blocking, a write waiting for a host that is not streaming would hold up close
+    sk->fd = open(path, O_RDWR | O_NONBLOCK);
+    if (sk->fd < 0) {
+        printf("audio: open %s failed: %s (%d)\n", path, strerror(errno), errno);
+        return -1;
+    }
+
+    memset(&hw, 0, sizeof(hw));
+    for (n=SNDRV_PCM_HW_PARAM_FIRST_MASK; n<=SNDRV_PCM_HW_PARAM_LAST_MASK; n++) {
+        memset(&hw.masks[n - SNDRV_PCM_HW_PARAM_FIRST_MASK], 0xff, sizeof(struct snd_mask));
+    }
+    for (n=SNDRV_PCM_HW_PARAM_FIRST_INTERVAL; n<=SNDRV_PCM_HW_PARAM_LAST_INTERVAL; n++) {
+        hw.intervals[n - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL].max = UINT_MAX;
+    }
+    hw.rmask = ~0U;
+    hw.info  = ~0U;
+    alsa_param_mask(&hw, SNDRV_PCM_HW_PARAM_ACCESS   , SNDRV_PCM_ACCESS_RW_INTERLEAVED);
+    alsa_param_mask(&hw, SNDRV_PCM_HW_PARAM_FORMAT   , SNDRV_PCM_FORMAT_S16_LE);
+    alsa_param_mask(&hw, SNDRV_PCM_HW_PARAM_SUBFORMAT, SNDRV_PCM_SUBFORMAT_STD);
+    alsa_param_int (&hw, SNDRV_PCM_HW_PARAM_SAMPLE_BITS, 16);
+    alsa_param_int (&hw, SNDRV_PCM_HW_PARAM_FRAME_BITS , 16 * channels);
+    alsa_param_int (&hw, SNDRV_PCM_HW_PARAM_CHANNELS   , channels);
+    alsa_param_int (&hw, SNDRV_PCM_HW_PARAM_RATE       , rate);
+    alsa_param_int (&hw, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, period);
+    alsa_param_int (&hw, SNDRV_PCM_HW_PARAM_PERIODS    , 4);
+    if (ioctl(sk->fd, SNDRV_PCM_IOCTL_HW_PARAMS, &hw) < 0) {
+        printf("audio: unable to set hw params: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    sk->buffer = hw.intervals[SNDRV_PCM_HW_PARAM_BUFFER_SIZE - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL].max;
+
+    memset(&sw, 0, sizeof(sw));
+    sw.tstamp_mode     = SNDRV_PCM_TSTAMP_ENABLE;
+    sw.period_step     = 1;
+    sw.avail_min       = period;
+    sw.start_threshold = period * 2;
+    sw.stop_threshold  = sk->buffer;
+    for (boundary=sk->buffer; boundary * 2 <= INT_MAX - sk->buffer; boundary *= 2);
+    sw.boundary        = boundary;
+    if (ioctl(sk->fd, SNDRV_PCM_IOCTL_SW_PARAMS, &sw) < 0 || ioctl(sk->fd, SNDRV_PCM_IOCTL_PREPARE) < 0) {
+        printf("audio: unable to set sw params: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    sk->paced = 1;
+    return 0;
+}
+
+static int
+audio_sink_open(struct audio_sink *sk, const char *spec, int rate, int channels, int period)
+{
+    int card, device;
+
+    sk->fd         = -1;
+    sk->frame_size = channels * 2;
+    if (sscanf(spec, "hw:%d,%d", &card, &device) == 2) {
+        return alsa_sink_open(sk, card, device, rate, channels, period);
+    }
+    if (strncmp(spec, "file:", 5) == 0) {
+        sk->fd = open(spec + 5, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sk->fd >= 0) return 0;
+        printf("audio: open %s failed: %s (%d)\n", spec + 5, strerror(errno), errno);
+        return -1;
+    }
+    printf("audio: unknown sink %s !\n", spec);
+    return -1;
+}
+
+// returns the frames taken, 0 when the device has no room yet
+static int
+audio_sink_write(struct audio_sink *sk, const int16_t *pcm, int frames)
+{
+    struct snd_xferi x;
+
+    if (!sk->paced) return write(sk->fd, pcm, frames * sk->frame_size) < 0 ? -1 : frames;
+
+    memset(&x, 0, sizeof(x));
+    x.buf    = (void*)pcm;
+    x.frames = frames;
+    if (ioctl(sk->fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x) == 0) return x.result;
+    if (errno == EAGAIN) return 0;
+    if (errno != EPIPE) return -1;
+    // underrun, the gadget stopped, restart from this period
+    if (ioctl(sk->fd, SNDRV_PCM_IOCTL_PREPARE) < 0) return -1;
+    if (ioctl(sk->fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x) == 0) return x.result;
+    return errno == EAGAIN ? 0 : -1;
+}
+
+// waits up to timeout ms for room in the device buffer
+static void
+audio_sink_wait(struct audio_sink *sk, int timeout)
+{
+    struct pollfd pfd = { sk->fd, POLLOUT, 0 };
+    if (poll(&pfd, 1, timeout) < 0) usleep(timeout * 1000);
+}
+
+// frames written but not yet played out
+static int
+audio_sink_delay(struct audio_sink *sk)
+{
+    snd_pcm_sframes_t delay = 0;
+    if (!sk->paced || ioctl(sk->fd, SNDRV_PCM_IOCTL_DELAY, &delay) < 0) return 0;
+    return delay;
+}
+
+/* ---------------------------------------------------------------------------
+ * Pump
+ */
+
+struct uvc_audio {
+    struct audio_sink sink;
+    int               rate;
+    int               channels;
+    int               period;
+
+    pthread_mutex_t   mutex;
+    int16_t          *ring;
+    int               size;      // frames
+    int               rpos;
+    int               count;
+    int64_t           wend;      // pts right after the last frame written
+    int64_t           wbase;     // pts of the first frame of the current contiguous run
+    int64_t           wframes;   // frames written since wbase
+
+    int               exit;
+    unsigned int      dropped;
+    unsigned int      silence;
+    pthread_t         thread;
+};
+
+static int64_t
+audio_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// duration of frames, from the count so that long contiguous runs do not drift
+static int64_t
+audio_frames_ns(struct uvc_audio *au, int64_t frames)
+{
+    return frames / au->rate * 1000000000LL + frames % au->rate * 1000000000LL / au->rate;
+}
+
+// fill out with the period that should be heard at playtime, dropping audio that is
+// too late and holding back audio that is too early, the tolerance is one period
+static void
+audio_take_period(struct uvc_audio *au, int16_t *out, int64_t playtime)
+{
+    int64_t skew, tol = audio_frames_ns(au, au->period);
+    int     n, drop, first;
+
+    pthread_mutex_lock(&au->mutex);
+    n = 0;
+    if (au->count) {
+        skew = au->wend - audio_frames_ns(au, au->count) - playtime;
+        if (skew < -tol) {
+            drop = -skew >= audio_frames_ns(au, au->count) ? au->count : -skew * au->rate / 1000000000LL;
+            au->rpos     = (au->rpos + drop) % au->size;
+            au->count   -= drop;
+            au->dropped += drop;
+        }
+        n = skew > tol ? 0 : au->count < au->period ? au->count : au->period;
+    }
+    first = au->size - au->rpos < n ? au->size - au->rpos : n;
+    memcpy(out, au->ring + au->rpos * au->channels, first * au->channels * 2);
+    memcpy(out + first * au->channels, au->ring, (n - first) * au->channels * 2);
+    au->rpos   = (au->rpos + n) % au->size;
+    au->count -= n;
+    if (n < au->period) au->silence += au->period - n;
+    pthread_mutex_unlock(&au->mutex);
+
+    memset(out + n * au->channels, 0, (au->period - n) * au->channels * 2);
+}
+
+static void* audio_pump_proc(void *argv)
+{
+    struct uvc_audio *au = (struct uvc_audio*)argv;
+    struct timespec   ts;
+    int16_t *buf;
+    int      off, ret;
+    int64_t  start, played = 0, deadline, playtime, now, period_ns = audio_frames_ns(au, au->period);
+
+    buf = malloc(au->period * au->sink.frame_size);
+    if (!buf) return NULL;
+
+    start = audio_clock_ns();
+    while (!au->exit) {
+        if (au->sink.paced) {
+            // the device clock paces us, the period written now plays after what is queued
+            playtime = audio_clock_ns() + audio_frames_ns(au, audio_sink_delay(&au->sink));
+        } else {
+            played  += au->period;
+            deadline = start + audio_frames_ns(au, played);
+            now = audio_clock_ns();
+            if (now - deadline > period_ns * 4) {
+                start  = deadline = now;
+                played = 0;
+            }
+            ts.tv_sec  = deadline / 1000000000;
+            ts.tv_nsec = deadline % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            playtime = deadline;
+        }
+        audio_take_period(au, buf, playtime);
+        // the wait is bounded so that close is noticed while the host is not streaming
+        for (off=0; off<au->period && !au->exit; off+=ret) {
+            if ((ret = audio_sink_write(&au->sink, buf + off * au->channels, au->period - off)) < 0) {
+                printf("audio: sink write failed: %s (%d)\n", strerror(errno), errno);
+                usleep(100*1000);
+                break;
+            }
+            if (!ret) audio_sink_wait(&au->sink, 100);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+struct uvc_audio* uvc_audio_open(const char *sink, int rate, int channels, int period)
+{
+    struct uvc_audio *au;
+
+    if (rate <= 0 || channels <= 0 || channels > 8 || period <= 0) return NULL;
+    au = calloc(1, sizeof(*au));
+    if (!au) return NULL;
+    au->sink.fd  = -1;
+    au->rate     = rate;
+    au->channels = channels;
+    au->period   = period;
+    au->size     = period * 16;
+    au->ring     = malloc(au->size * channels * 2);
+    pthread_mutex_init(&au->mutex, NULL);
+    if (!au->ring || audio_sink_open(&au->sink, sink, rate, channels, period) < 0) {
+        uvc_audio_close(au);
+        return NULL;
+    }
+    if (pthread_create(&au->thread, NULL, audio_pump_proc, au) != 0) {
+        au->thread = 0;
+        uvc_audio_close(au);
+        return NULL;
+    }
+    printf("audio: %s, %d Hz, %d ch, %d frames per period\n", sink, rate, channels, period);
+    return au;
+}
+
+void uvc_audio_close(struct uvc_audio *au)
+{
+    if (!au) return;
+    au->exit = 1;
+    if (au->thread) pthread_join(au->thread, NULL);
+    if (au->sink.fd >= 0) close(au->sink.fd);
+    pthread_mutex_destroy(&au->mutex);
+    free(au->ring);
+    free(au);
+}
+
+int uvc_audio_write(struct uvc_audio *au, const int16_t *pcm, int frames, int64_t pts)
+{
+    int n, wpos, first;
+
+    pthread_mutex_lock(&au->mutex);
+    n = au->size - au->count < frames ? au->size - au->count : frames;
+    wpos  = (au->rpos + au->count) % au->size;
+    first = au->size - wpos < n ? au->size - wpos : n;
+    memcpy(au->ring + wpos * au->channels, pcm, first * au->channels * 2);
+    memcpy(au->ring, pcm + first * au->channels, (n - first) * au->channels * 2);
+    au->count += n;
+    if (pts || au->count == n) {
+        au->wbase   = pts ? pts : audio_clock_ns();
+        au->wframes = 0;
+    }
+    au->wframes += n;
+    au->wend     = au->wbase + audio_frames_ns(au, au->wframes);
+    pthread_mutex_unlock(&au->mutex);
+    return n;
+}
@@ -0,0 +1,14 @@
+#ifndef __UVC_AUDIO_H__
+#define __UVC_AUDIO_H__
+
+#include <stdint.h>
+
+// pcm ring pumped period by period into the UAC function, pts are CLOCK_MONOTONIC
+// nanoseconds like the video side, sink is "hw:card,device" or "file:/path"
+struct uvc_audio;
+
+struct uvc_audio* uvc_audio_open (const char *sink, int rate, int channels, int period);
+void              uvc_audio_close(struct uvc_audio *au);
+int               uvc_audio_write(struct uvc_audio *au, const int16_t *pcm, int frames, int64_t pts);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include "uvc_source.h"
+
+/* ---------------------------------------------------------------------------
+ * V4L2 capture bridge: a sensor, ISP, vivid or v4l2loopback node as the frame
+ * source. Capture buffers are mapped from the node and handed to the gadget
+ * side in place, so the fill is the only copy. A buffer goes back to the
+ * driver on the next read, once every stream is done with it.
+ */
+
+#define CAPTURE_MAX_BUFS 8
+
+struct capture_buf {
+    uint8_t *mem;
+    size_t   len;
+};
+
+struct uvc_capture {
+    struct uvc_source  src;
+    int                fd;
+    int                nbufs;
+    int                mapped;
+    struct capture_buf bufs[CAPTURE_MAX_BUFS];
+    int                cur; // handed out, -1: none
+    int                streaming;
+    unsigned int       fcc;
+    int                width;
+    int                height;
+    int                stride;
+    uint8_t           *cbuf; // compacted frame when the driver pads lines
+    int                cbufsize;
+};
+
+static int
+capture_xioctl(int fd, unsigned long req, void *arg)
+{
+    int ret;
+    while ((ret = ioctl(fd, req, arg)) < 0 && errno == EINTR);
+    return ret;
+}
+
+static int
+capture_qbuf(struct uvc_capture *cp, int index)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.index  = index;
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (capture_xioctl(cp->fd, VIDIOC_QBUF, &buf) < 0) {
+        printf("capture: unable to queue buffer %d: %s (%d)\n", index, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+capture_stop(struct uvc_capture *cp)
+{
+    struct v4l2_requestbuffers rb;
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE, i;
+
+    if (cp->streaming) capture_xioctl(cp->fd, VIDIOC_STREAMOFF, &type);
+    cp->streaming = 0;
+    cp->cur = -1;
+    for (i=0; i<cp->mapped; i++) munmap(cp->bufs[i].mem, cp->bufs[i].len);
+    cp->mapped = 0;
+    if (cp->nbufs) {
+        memset(&rb, 0, sizeof(rb));
+        rb.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        rb.memory = V4L2_MEMORY_MMAP;
+        capture_xioctl(cp->fd, VIDIOC_REQBUFS, &rb);
+    }
+    cp->nbufs = 0;
+}
+
+// exact says whether the driver may pick another size, returns 0 when it took fcc
+static int
+capture_set_format(struct uvc_capture *cp, unsigned int fcc, int width, int height, int exact)
+{
+    struct v4l2_format fmt;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.pixelformat = fcc;
+    fmt.fmt.pix.width       = width;
+    fmt.fmt.pix.height      = height;
+    fmt.fmt.pix.field       = V4L2_FIELD_NONE;
+    if (capture_xioctl(cp->fd, VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix.pixelformat != fcc) return -1;
+    if (fmt.fmt.pix.field != V4L2_FIELD_NONE && fmt.fmt.pix.field != V4L2_FIELD_ANY) return -1;
+    if (exact && ((int)fmt.fmt.pix.width != width || (int)fmt.fmt.pix.height != height)) return -1;
+
+    cp->fcc    = fcc;
+    cp->width  = fmt.fmt.pix.width;
+    cp->height = fmt.fmt.pix.height;
+    cp->stride = fmt.fmt.pix.bytesperline;
+    return 0;
+}
+
+static int
+capture_map(struct uvc_capture *cp)
+{
+    struct v4l2_requestbuffers rb;
+    struct v4l2_buffer         buf;
+    struct capture_buf        *b;
+    int i;
+
+    memset(&rb, 0, sizeof(rb));
+    rb.count  = CAPTURE_MAX_BUFS / 2;
+    rb.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    rb.memory = V4L2_MEMORY_MMAP;
+    if (capture_xioctl(cp->fd, VIDIOC_REQBUFS, &rb) < 0 || rb.count < 2) {
+        printf("capture: unable to allocate buffers: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    cp->nbufs = rb.count < CAPTURE_MAX_BUFS ? rb.count : CAPTURE_MAX_BUFS;
+
+    for (i=0; i<cp->nbufs; i++) {
+        b = &cp->bufs[i];
+        memset(&buf, 0, sizeof(buf));
+        buf.index  = i;
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (capture_xioctl(cp->fd, VIDIOC_QUERYBUF, &buf) < 0) return -1;
+
+        b->len = buf.length;
+        b->mem = mmap(NULL, b->len, PROT_READ, MAP_SHARED, cp->fd, buf.m.offset);
+        if (b->mem == MAP_FAILED) {
+            printf("capture: unable to map buffer %d: %s (%d)\n", i, strerror(errno), errno);
+            return -1;
+        }
+        cp->mapped = i + 1;
+    }
+    printf("capture: %d buffers mapped\n", cp->nbufs);
+    return 0;
+}
+
+static int
+capture_start(struct uvc_source *src, unsigned int fcc, int width, int height)
+{
+    struct uvc_capture *cp = (struct uvc_capture*)src;
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE, i;
+
+    capture_stop(cp);
+    // the committed format as is, else NV12 at any size for what the library builds from it
+    if (capture_set_format(cp, fcc, width, height, fcc != V4L2_PIX_FMT_NV12) < 0) {
+        if ((fcc != V4L2_PIX_FMT_MJPEG && fcc != V4L2_PIX_FMT_YUYV && fcc != V4L2_PIX_FMT_UYVY)
+         || capture_set_format(cp, V4L2_PIX_FMT_NV12, width, height, 0) < 0) {
+            printf("capture: device has no format for %.4s %dx%d\n", (char*)&fcc, width, height);
+            return -1;
+        }
+    }
+    printf("capture: %.4s %dx%d stride %d for %.4s %dx%d\n", (char*)&cp->fcc, cp->width, cp->height, cp->stride,
+           (char*)&fcc, width, height);
+
+    if (capture_map(cp) < 0) {
+        capture_stop(cp);
+        return -1;
+    }
+    for (i=0; i<cp->nbufs; i++) {
+        if (capture_qbuf(cp, i) < 0) break;
+    }
+    if (i < cp->nbufs || capture_xioctl(cp->fd, VIDIOC_STREAMON, &type) < 0) {
+        printf("capture: unable to start streaming: %s (%d)\n", strerror(errno), errno);
+        capture_stop(cp);
+        return -1;
+    }
+    cp->streaming = 1;
+    return 0;
+}
+
+// padded lines are packed tight, the library reads frames with stride == width
+static uint8_t*
+capture_compact(struct uvc_capture *cp, const uint8_t *p, int *len)
+{
+    int bpl  = cp->fcc == V4L2_PIX_FMT_NV12 ? cp->width : cp->width * 2;
+    int rows = cp->fcc == V4L2_PIX_FMT_NV12 ? cp->height * 3 / 2 : cp->height;
+    int size = bpl * rows, i;
+
+    if (cp->cbufsize < size) {
+        free(cp->cbuf);
+        cp->cbuf     = malloc(size);
+        cp->cbufsize = cp->cbuf ? size : 0;
+        if (!cp->cbuf) return NULL;
+    }
+    for (i=0; i<rows; i++) memcpy(cp->cbuf + i * bpl, p + i * cp->stride, bpl);
+    *len = size;
+    return cp->cbuf;
+}
+
+static int
+capture_read(struct uvc_source *src, struct camuvc_frame *frame)
+{
+    struct uvc_capture *cp = (struct uvc_capture*)src;
+    struct pollfd      pfd = { cp->fd, POLLIN, 0 };
+    struct v4l2_buffer buf;
+    int compressed = cp->fcc != V4L2_PIX_FMT_NV12 && cp->fcc != V4L2_PIX_FMT_YUYV && cp->fcc != V4L2_PIX_FMT_UYVY;
+    int len;
+
+    if (!cp->streaming) return -1;
+    // every stream is done with the previous frame by now
+    if (cp->cur >= 0) {
+        capture_qbuf(cp, cp->cur);
+        cp->cur = -1;
+    }
+
+    // short timeout so that the capture thread still notices exit
+    if (poll(&pfd, 1, 100) <= 0) return -1;
+    memset(&buf, 0, sizeof(buf));
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (capture_xioctl(cp->fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno != EAGAIN) printf("capture: unable to dequeue buffer: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    if (buf.index >= (unsigned int)cp->nbufs || (buf.flags & V4L2_BUF_FLAG_ERROR) || !buf.bytesused) {
+        capture_qbuf(cp, buf.index);
+        return -1;
+    }
+    cp->cur = buf.index;
+
+    frame->data   = cp->bufs[cp->cur].mem;
+    frame->len    = buf.bytesused;
+    frame->fcc    = cp->fcc;
+    frame->width  = cp->width;
+    frame->height = cp->height;
+    if (!compressed && cp->stride != (cp->fcc == V4L2_PIX_FMT_NV12 ? cp->width : cp->width * 2)) {
+        if (!(frame->data = capture_compact(cp, frame->data, &len))) return -1;
+        frame->len = len;
+    }
+    frame->yoff = 0;
+    frame->uoff = cp->fcc == V4L2_PIX_FMT_NV12 ? cp->width * cp->height : 0;
+    return 0;
+}
+
+static void
+capture_close(struct uvc_source *src)
+{
+    struct uvc_capture *cp = (struct uvc_capture*)src;
+
+    capture_stop(cp);
+    if (cp->fd >= 0) close(cp->fd);
+    free(cp->cbuf);
+    free(cp);
+}
+
+struct uvc_source* uvc_capture_open(const char *devname)
+{
+    struct v4l2_capability cap;
+    struct uvc_capture    *cp;
+    unsigned int caps;
+
+    cp = calloc(1, sizeof(*cp));
+    if (!cp) return NULL;
+    cp->cur = -1;
+    cp->fd  = open(devname, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (cp->fd < 0) {
+        printf("capture: open %s failed: %s (%d)\n", devname, strerror(errno), errno);
+        free(cp);
+        return NULL;
+    }
+    memset(&cap, 0, sizeof(cap));
+    caps = capture_xioctl(cp->fd, VIDIOC_QUERYCAP, &cap) == 0 ? cap.capabilities : 0;
+    if (caps & V4L2_CAP_DEVICE_CAPS) caps = cap.device_caps;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+        printf("capture: %s is not a single-planar streaming capture device\n", devname);
+        capture_close(&cp->src);
+        return NULL;
+    }
+    printf("capture: %s is %s\n", devname, cap.card);
+
+    // the sensor sets the pace
+    cp->src.paced = 0;
+    cp->src.start = capture_start;
+    cp->src.read  = capture_read;
+    cp->src.close = capture_close;
+    return &cp->src;
+}
@@ -0,0 +1,362 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include "uvc_gadget.h"
+#include "camuvc.h"
+
+/* ---------------------------------------------------------------------------
+ * configfs gadget builder. On configfs the function directories come with
+ * their default groups and attributes, in dry-run mode root is a plain
+ * directory, so every directory is created with its parents and attributes
+ * are created as regular files.
+ */
+
+#define GADGET_MAX_FORMATS 16
+
+struct uvc_gadget {
+    char         path[256]; // gadget directory
+    char         func[320]; // uvc function directory
+    int          nfuncs;
+    int          flags;
+    int          nformats;
+    char         formats[GADGET_MAX_FORMATS][64]; // relative to func/streaming
+    char         frame_dir[384];
+    int          nframes;
+    int          framebased;
+    int          ret;
+    int64_t      peakbps;   // highest frame size x rate, sizes the endpoint
+    int          maxpacket; // smallest isoc streaming_maxpacket written
+};
+
+// what the last gadget built by this process carries per microframe, 0 if none
+static int g_gadget_maxpacket;
+
+static int
+gadget_mkdir(const char *path)
+{
+    char tmp[384], *p;
+
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (p=tmp+1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) < 0 && errno != EEXIST) break;
+        *p = '/';
+    }
+    if (mkdir(tmp, 0755) < 0 && errno != EEXIST) {
+        printf("gadget: mkdir %s failed: %s (%d)\n", path, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+gadget_write(const char *dir, const char *attr, const void *data, int len)
+{
+    char path[448];
+    int  fd, ret;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("gadget: open %s failed: %s (%d)\n", path, strerror(errno), errno);
+        return -1;
+    }
+    ret = write(fd, data, len);
+    close(fd);
+    if (ret != len) {
+        printf("gadget: write %s failed: %s (%d)\n", path, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+// attribute as a number, -1 if it cannot be read
+static int
+gadget_read_int(const char *dir, const char *attr)
+{
+    char path[448], buf[32];
+    int  fd, len;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    if ((fd = open(path, O_RDONLY)) < 0) return -1;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0 || !isdigit((unsigned char)buf[0])) return -1;
+    buf[len] = '\0';
+    return atoi(buf);
+}
+
+static int
+gadget_printf(const char *dir, const char *attr, const char *fmt, ...)
+{
+    char    buf[256];
+    va_list ap;
+    int     len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return gadget_write(dir, attr, buf, len);
+}
+
+// configfs resolves link targets against the cwd, so targets are always absolute
+static int
+gadget_link(const char *target, const char *dir, const char *name)
+{
+    char link[448];
+
+    snprintf(link, sizeof(link), "%s/%s", dir, name);
+    if (gadget_mkdir(dir) < 0) return -1;
+    if (symlink(target, link) < 0 && errno != EEXIST) {
+        printf("gadget: link %s -> %s failed: %s (%d)\n", link, target, strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+gadget_first_udc(char *udc, int size)
+{
+    struct dirent *de;
+    DIR *dir = opendir("/sys/class/udc");
+
+    if (!dir) return -1;
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.') continue;
+        snprintf(udc, size, "%s", de->d_name);
+        closedir(dir);
+        return 0;
+    }
+    closedir(dir);
+    return -1;
+}
+
+struct uvc_gadget* uvc_gadget_open(const char *root, const char *name, int flags)
+{
+    struct uvc_gadget *g;
+    char   dir[384];
+
+    g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+    g->flags = flags;
+    snprintf(g->path, sizeof(g->path), "%s/%s", root, name);
+    if (gadget_mkdir(g->path) < 0) {
+        free(g);
+        return NULL;
+    }
+
+    // same ids as the legacy g_webcam module so hosts keep their driver binding
+    g->ret |= gadget_printf(g->path, "idVendor" , "0x1d6b");
+    g->ret |= gadget_printf(g->path, "idProduct", "0x0102");
+    g->ret |= gadget_printf(g->path, "bcdDevice", "0x0100");
+    g->ret |= gadget_printf(g->path, "bcdUSB"   , "0x0200");
+    g->ret |= gadget_printf(g->path, "bDeviceClass"   , "0xef");
+    g->ret |= gadget_printf(g->path, "bDeviceSubClass", "0x02");
+    g->ret |= gadget_printf(g->path, "bDeviceProtocol", "0x01");
+    snprintf(dir, sizeof(dir), "%s/strings/0x409", g->path);
+    g->ret |= gadget_mkdir(dir);
+    g->ret |= gadget_printf(dir, "manufacturer", "camuvc");
+    g->ret |= gadget_printf(dir, "product"     , "UVC Camera");
+    g->ret |= gadget_printf(dir, "serialnumber", "0123456789");
+    snprintf(dir, sizeof(dir), "%s/configs/c.1/strings/0x409", g->path);
+    g->ret |= gadget_mkdir(dir);
+    g->ret |= gadget_printf(dir, "configuration", "UVC");
+    snprintf(dir, sizeof(dir), "%s/configs/c.1", g->path);
+    g->ret |= gadget_printf(dir, "MaxPower", "500");
+    return g;
+}
+
+// wires up the streaming and control headers of the current function and adds it to the config
+static void
+gadget_finish_function(struct uvc_gadget *g)
+{
+    static const char *speeds[] = { "fs", "hs", "ss" };
+    char   hdr[384], dir[384], target[448], name[64];
+    int    maxpacket, i;
+
+    // control interface headers
+    snprintf(hdr, sizeof(hdr), "%s/control/header/h", g->func);
+    snprintf(dir, sizeof(dir), "%s/control/class/fs", g->func);
+    g->ret |= gadget_link(hdr, dir, "h");
+    snprintf(dir, sizeof(dir), "%s/control/class/ss", g->func);
+    g->ret |= gadget_link(hdr, dir, "h");
+
+    // formats get their index from the order they are linked into the header
+    snprintf(hdr, sizeof(hdr), "%s/streaming/header/h", g->func);
+    g->ret |= gadget_mkdir(hdr);
+    for (i=0; i<g->nformats; i++) {
+        snprintf(target, sizeof(target), "%s/streaming/%s", g->func, g->formats[i]);
+        snprintf(name, sizeof(name), "%s", strchr(g->formats[i], '/') + 1);
+        g->ret |= gadget_link(target, hdr, name);
+    }
+    for (i=0; i<(int)(sizeof(speeds) / sizeof(speeds[0])); i++) {
+        snprintf(dir, sizeof(dir), "%s/streaming/class/%s", g->func, speeds[i]);
+        g->ret |= gadget_link(hdr, dir, "h");
+    }
+
+    // high speed isoc: up to 3 x 1024 bytes per microframe, sized for the busiest frame
+    maxpacket = (g->peakbps / 8 / 8000 + 1023) / 1024 * 1024;
+    maxpacket = maxpacket < 1024 ? 1024 : maxpacket > 3072 ? 3072 : maxpacket;
+    if (g->flags & CAMUVC_GADGET_BULK) {
+        // only vendor kernels carry the bulk attribute, mainline f_uvc is isoc only
+        if (gadget_printf(g->func, "streaming_bulk", "1") < 0) printf("gadget: no bulk streaming support !\n");
+        maxpacket = 512;
+    }
+    g->ret |= gadget_printf(g->func, "streaming_maxpacket", "%d", maxpacket);
+    if (!(g->flags & CAMUVC_GADGET_BULK) && (!g->maxpacket || maxpacket < g->maxpacket)) g->maxpacket = maxpacket;
+    g->ret |= gadget_printf(g->func, "streaming_interval" , "1");
+
+    snprintf(dir, sizeof(dir), "%s/configs/c.1", g->path);
+    snprintf(name, sizeof(name), "uvc.%d", g->nfuncs - 1);
+    g->ret |= gadget_link(g->func, dir, name);
+    printf("gadget: %s, %d formats, maxpacket %d\n", g->func, g->nformats, maxpacket);
+}
+
+int uvc_gadget_function(struct uvc_gadget *g)
+{
+    char dir[384];
+
+    if (g->nfuncs) gadget_finish_function(g);
+    snprintf(g->func, sizeof(g->func), "%s/functions/uvc.%d", g->path, g->nfuncs++);
+    g->nformats = 0;
+    g->peakbps  = 0;
+    snprintf(dir, sizeof(dir), "%s/control/header/h", g->func);
+    return gadget_mkdir(dir);
+}
+
+int uvc_gadget_format(struct uvc_gadget *g, unsigned int fcc)
+{
+    // {fourcc}-0000-0010-8000-00aa00389b71, the usual uvc guid for a fourcc
+    uint8_t guid[16] = { 0, 0, 0, 0, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+    char    dir[384], *rel = g->formats[g->nformats];
+
+    if (!g->nfuncs || g->nformats == GADGET_MAX_FORMATS) return -1;
+    memcpy(guid, fcc == V4L2_PIX_FMT_YUYV ? (const void*)"YUY2" : (const void*)&fcc, 4); // yuyv is YUY2 on the wire
+    switch (fcc) {
+    case V4L2_PIX_FMT_NV12 : snprintf(rel, 64, "uncompressed/nv12"); break;
+    case V4L2_PIX_FMT_YUYV : snprintf(rel, 64, "uncompressed/yuyv"); break;
+    case V4L2_PIX_FMT_UYVY : snprintf(rel, 64, "uncompressed/uyvy"); break;
+    case V4L2_PIX_FMT_MJPEG: snprintf(rel, 64, "mjpeg/mjpeg"); break;
+    default:
+        // frame based payloads, H.264 and H.265
+        snprintf(rel, 64, "framebased/%c%c%c%c", tolower(fcc & 0xff), tolower((fcc >> 8) & 0xff),
+                 tolower((fcc >> 16) & 0xff), tolower((fcc >> 24) & 0xff));
+        break;
+    }
+    snprintf(dir, sizeof(dir), "%s/streaming/%s", g->func, rel);
+    if (gadget_mkdir(dir) < 0) return -1;
+    g->nformats++;
+    if (fcc == V4L2_PIX_FMT_NV12 || fcc == V4L2_PIX_FMT_YUYV || fcc == V4L2_PIX_FMT_UYVY) {
+        g->ret |= gadget_write (dir, "guidFormat", guid, sizeof(guid));
+        g->ret |= gadget_printf(dir, "bBitsPerPixel", fcc == V4L2_PIX_FMT_NV12 ? "12" : "16");
+    } else if (fcc != V4L2_PIX_FMT_MJPEG) {
+        g->ret |= gadget_write (dir, "guidFormat", guid, sizeof(guid));
+    }
+    snprintf(g->frame_dir, sizeof(g->frame_dir), "%s", dir);
+    g->nframes    = 0;
+    g->framebased = !strncmp(rel, "framebased/", 11);
+    return 0;
+}
+
+int uvc_gadget_frame(struct uvc_gadget *g, int width, int height, int maxfsize, const unsigned int *intervals)
+{
+    char dir[448], list[128];
+    int  i, len;
+
+    if (!g->nformats || !intervals[0]) return -1;
+    snprintf(dir, sizeof(dir), "%s/%dx%d", g->frame_dir, width, height);
+    if (gadget_mkdir(dir) < 0) return -1;
+    g->nframes++;
+
+    for (i=0, len=0; i<8 && intervals[i]; i++) {
+        len += snprintf(list + len, sizeof(list) - len, "%u\n", intervals[i]);
+        if (g->peakbps < (int64_t)maxfsize * 8 * 10000000 / intervals[i]) {
+            g->peakbps = (int64_t)maxfsize * 8 * 10000000 / intervals[i];
+        }
+    }
+    g->ret |= gadget_printf(dir, "wWidth" , "%d", width );
+    g->ret |= gadget_printf(dir, "wHeight", "%d", height);
+    if (g->framebased) g->ret |= gadget_printf(dir, "dwBytesPerLine", "0");
+    else g->ret |= gadget_printf(dir, "dwMaxVideoFrameBufferSize", "%d", maxfsize);
+    g->ret |= gadget_printf(dir, "dwDefaultFrameInterval", "%u", intervals[0]);
+    g->ret |= gadget_write (dir, "dwFrameInterval", list, len);
+    g->ret |= gadget_printf(dir, "dwMinBitRate", "%lld", (long long)maxfsize * 8 * 10000000 / intervals[i - 1]);
+    g->ret |= gadget_printf(dir, "dwMaxBitRate", "%lld", (long long)maxfsize * 8 * 10000000 / intervals[0]);
+    return 0;
+}
+
+int uvc_gadget_close(struct uvc_gadget *g, const char *udc)
+{
+    char   dir[384], target[448], found[256];
+    int    ret;
+
+    if (g->nfuncs) gadget_finish_function(g);
+    snprintf(dir, sizeof(dir), "%s/configs/c.1", g->path);
+    if (g->flags & CAMUVC_GADGET_UAC1) {
+        snprintf(target, sizeof(target), "%s/functions/uac1.0", g->path);
+        g->ret |= gadget_mkdir(target);
+        g->ret |= gadget_link(target, dir, "uac1.0");
+    }
+
+    ret = g->ret ? -1 : 0;
+    if (ret == 0) {
+        if (!udc && !(g->flags & CAMUVC_GADGET_DRYRUN) && gadget_first_udc(found, sizeof(found)) == 0) udc = found;
+        if (udc) ret = gadget_printf(g->path, "UDC", "%s", udc);
+        else if (!(g->flags & CAMUVC_GADGET_DRYRUN)) {
+            printf("gadget: no udc found !\n");
+            ret = -1;
+        }
+    }
+    if (ret) printf("gadget: %s failed !\n", g->path);
+    if (!ret && !(g->flags & CAMUVC_GADGET_DRYRUN)) g_gadget_maxpacket = g->maxpacket;
+    free(g);
+    return ret;
+}
+
+// whether the gadget at path is bound to a udc
+static int
+gadget_bound(const char *path)
+{
+    char file[448], udc[64];
+    int  fd, len;
+
+    snprintf(file, sizeof(file), "%s/UDC", path);
+    if ((fd = open(file, O_RDONLY)) < 0) return 0;
+    len = read(fd, udc, sizeof(udc));
+    close(fd);
+    return len > 0 && !isspace((unsigned char)udc[0]);
+}
+
+int uvc_gadget_maxpacket(const char *root)
+{
+    char   pattern[320], gadget[320], *p;
+    glob_t gl;
+    size_t i;
+    int    v, best = g_gadget_maxpacket;
+
+    if (best) return best;
+    // built elsewhere, read it back from the isoc uvc functions of bound gadgets
+    snprintf(pattern, sizeof(pattern), "%s/*/functions/uvc.*", root);
+    if (glob(pattern, GLOB_ONLYDIR, NULL, &gl) != 0) return 0;
+    for (i=0; i<gl.gl_pathc; i++) {
+        snprintf(gadget, sizeof(gadget), "%s", gl.gl_pathv[i]);
+        if (!(p = strstr(gadget, "/functions/"))) continue;
+        *p = '\0';
+        if (!gadget_bound(gadget) || gadget_read_int(gl.gl_pathv[i], "streaming_bulk") == 1) continue;
+        v = gadget_read_int(gl.gl_pathv[i], "streaming_maxpacket");
+        if (v > 0 && (!best || v < best)) best = v;
+    }
+    globfree(&gl);
+    return best;
+}
@@ -0,0 +1,18 @@
+#ifndef __UVC_GADGET_H__
+#define __UVC_GADGET_H__
+
+// writes the configfs tree of a uvc gadget, formats and frames are added in the
+// order they get their bFormatIndex / bFrameIndex
+struct uvc_gadget;
+
+struct uvc_gadget* uvc_gadget_open    (const char *root, const char *name, int flags);
+int                uvc_gadget_function(struct uvc_gadget *g); // starts the next uvc.N function
+int                uvc_gadget_format  (struct uvc_gadget *g, unsigned int fcc);
+int                uvc_gadget_frame   (struct uvc_gadget *g, int width, int height, int maxfsize, const unsigned int *intervals);
+// links everything together and binds udc (NULL: first one found), frees g
+int                uvc_gadget_close   (struct uvc_gadget *g, const char *udc);
+// isoc bytes per microframe of the uvc gadget, as written by the last uvc_gadget_close()
+// of this process or else read back from the bound gadgets under root, 0 if unknown
+int                uvc_gadget_maxpacket(const char *root);
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include "uvc_gather.h"
+
+/* ---------------------------------------------------------------------------
+ * Only the nal units leading each buffer are looked at, up to the first slice,
+ * encoders hand out one or a few units per buffer so the slice data itself is
+ * touched once, by the copy.
+ */
+
+void uvc_gather_reset(struct uvc_gather *g, unsigned int fcc)
+{
+    int repeat = g->repeat;
+    memset(g, 0, sizeof(*g));
+    g->repeat = repeat;
+    if (fcc == v4l2_fourcc('H','2','6','4')) g->codec = 1;
+    if (fcc == v4l2_fourcc('H','2','6','5')) g->codec = 2;
+}
+
+// type of the nal unit at p, -1 if there is no start code, *sc gets its length
+static int
+gather_nal_type(const struct uvc_gather *g, const uint8_t *p, int len, int *sc)
+{
+    if (len >= 4 && !p[0] && !p[1] && p[2] == 1) *sc = 3;
+    else if (len >= 5 && !p[0] && !p[1] && !p[2] && p[3] == 1) *sc = 4;
+    else return -1;
+    return g->codec == 2 ? (p[*sc] >> 1) & 0x3f : p[*sc] & 0x1f;
+}
+
+// offset of the start code following off, len if there is none
+static int
+gather_next_nal(const uint8_t *p, int off, int len)
+{
+    for (; off + 3 <= len; off++) {
+        if (!p[off] && !p[off + 1] && p[off + 2] == 1) return !p[off - 1] ? off - 1 : off;
+    }
+    return len;
+}
+
+// slot in ps[] for a parameter set, -1 for other units
+static int
+gather_pset(const struct uvc_gather *g, int type)
+{
+    if (g->codec == 2) return type >= 32 && type <= 34 ? type - 32 : -1;
+    return type == 7 ? 1 : type == 8 ? 2 : -1;
+}
+
+static int
+gather_copy(uint8_t *dst, int room, const void *src, int len)
+{
+    if (len > room) len = room;
+    if (len > 0) memcpy(dst, src, len);
+    return len > 0 ? len : 0;
+}
+
+int uvc_gather_frame(struct uvc_gather *g, uint8_t *dst, int size, const struct iovec *iov, int iovcnt)
+{
+    const uint8_t *p;
+    int i, k, n, t, sc, off, end, len, irap = 0, vcl = 0, haveps = 0;
+
+    for (i=0; g->repeat && g->codec && i<iovcnt && !vcl; i++) {
+        p   = iov[i].iov_base;
+        len = iov[i].iov_len;
+        for (off=0; off<len; off=end) {
+            if ((t = gather_nal_type(g, p + off, len - off, &sc)) < 0) break;
+            if (g->codec == 2 ? t < 32 : t >= 1 && t <= 5) {
+                vcl  = 1;
+                irap = g->codec == 2 ? t >= 16 && t <= 21 : t == 5;
+                break;
+            }
+            end = gather_next_nal(p, off + sc + 1, len);
+            if ((k = gather_pset(g, t)) >= 0) {
+                haveps = 1;
+                if (end - off <= GATHER_MAX_PSET) {
+                    memcpy(g->ps[k], p + off, end - off);
+                    g->pslen[k] = end - off;
+                }
+            }
+        }
+    }
+
+    g->irap = g->codec ? irap : 1;
+    n = 0;
+    if (irap && !haveps) {
+        for (k=0; k<3; k++) n += gather_copy(dst + n, size - n, g->ps[k], g->pslen[k]);
+    }
+    for (i=0; i<iovcnt; i++) n += gather_copy(dst + n, size - n, iov[i].iov_base, iov[i].iov_len);
+    return n;
+}
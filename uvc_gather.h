@@ -0,0 +1,23 @@
+#ifndef __UVC_GATHER_H__
+#define __UVC_GATHER_H__
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define GATHER_MAX_PSET 512
+
+// copies an encoded frame that comes in pieces into the gadget buffer, with repeat
+// set the h.264/h.265 parameter sets last seen go in front of IDRs that lack them
+struct uvc_gather {
+    int      codec;  // 0: other, 1: h.264, 2: h.265
+    int      repeat;
+    int      irap;   // the last frame was a key frame, only tracked with repeat on
+    int      pslen[3]; // vps, sps, pps
+    uint8_t  ps[3][GATHER_MAX_PSET];
+};
+
+void uvc_gather_reset(struct uvc_gather *g, unsigned int fcc); // keeps repeat
+// returns the bytes written to dst, what does not fit into size is cut off
+int  uvc_gather_frame(struct uvc_gather *g, uint8_t *dst, int size, const struct iovec *iov, int iovcnt);
+
+#endif
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "uvc_govern.h"
+
+#define GOVERN_WINDOW_NS (500 * 1000 * 1000LL)
+
+void uvc_govern_reset(struct uvc_govern *g, int flags, int budget, int interval)
+{
+    static const uint8_t rates[][2] = { { 3, 4 }, { 2, 3 }, { 1, 2 }, { 1, 3 } };
+    static const uint8_t pcts[] = { 75, 50 };
+    unsigned int i;
+
+    memset(g, 0, sizeof(*g));
+    g->flags    = budget > 0 ? flags : 0;
+    g->budget   = budget;
+    g->interval = (int64_t)interval * 100;
+    g->hold     = 2;
+
+    // full rate first, then fewer frames, then fewer bits at the lowest rate
+    g->levels[g->nlevels].num = g->levels[g->nlevels].den = 1;
+    g->levels[g->nlevels++].pct = 100;
+    for (i=0; i<sizeof(rates)/sizeof(rates[0]) && (g->flags & (GOVERN_FPS | GOVERN_SKIP)); i++) {
+        g->levels[g->nlevels].num   = rates[i][0];
+        g->levels[g->nlevels].den   = rates[i][1];
+        g->levels[g->nlevels++].pct = 100;
+    }
+    for (i=0; i<sizeof(pcts)/sizeof(pcts[0]) && (g->flags & GOVERN_BITRATE); i++) {
+        g->levels[g->nlevels]       = g->levels[g->nlevels - 1];
+        g->levels[g->nlevels++].pct = pcts[i];
+    }
+}
+
+// ns between frames at level
+static int64_t
+govern_level_interval(struct uvc_govern *g, int level)
+{
+    return g->interval * g->levels[level].den / g->levels[level].num;
+}
+
+int uvc_govern_frame(struct uvc_govern *g, int64_t cost, int64_t now)
+{
+    int64_t target, cost_avg, span;
+    int     level = g->level;
+
+    if (g->nlevels < 2 || !g->interval) return 0;
+    target = govern_level_interval(g, g->level);
+    // a frame that comes more than half an interval late shows as stutter on the host
+    if (g->last && now - g->last > target * 3 / 2) g->wlate++;
+    g->last   = now;
+    g->wcost += cost;
+    g->wframes++;
+
+    if (!g->wstart) g->wstart = now;
+    span = now - g->wstart;
+    if (span < GOVERN_WINDOW_NS || g->wframes < 4) return 0;
+    cost_avg = g->wcost / g->wframes;
+    g->underruns += g->wlate;
+
+    // late frames only count while our own work takes a good part of the interval,
+    // a producer that is idle on its own is not helped by stepping down
+    if (cost_avg * 100 > target * g->budget || (g->wlate * 8 > g->wframes && cost_avg * 200 > target * g->budget)) {
+        if (g->level < g->nlevels - 1) g->level++;
+        // a step up that did not last makes the next one wait longer
+        if (g->tup && now - g->tup < 2 * GOVERN_WINDOW_NS && g->hold < 32) g->hold *= 2;
+        g->calm = 0;
+        g->tup  = 0;
+    } else if (g->level > 0 && !g->wlate && cost_avg * 400 < govern_level_interval(g, g->level - 1) * g->budget * 3) {
+        if (++g->calm >= g->hold) {
+            g->level--;
+            g->calm = 0;
+            g->tup  = now;
+        }
+    } else {
+        g->calm = 0;
+    }
+    // settled for a while, forget about failed steps up
+    if (g->tup && now - g->tup > 30 * GOVERN_WINDOW_NS) {
+        g->hold = 2;
+        g->tup  = 0;
+    }
+
+    g->wstart  = now;
+    g->wcost   = 0;
+    g->wframes = 0;
+    g->wlate   = 0;
+    if (level != g->level) g->last = 0; // the new pace starts here
+    return level != g->level;
+}
+
+int uvc_govern_skip(struct uvc_govern *g)
+{
+    int level = g->level;
+
+    if (!(g->flags & GOVERN_SKIP) || g->levels[level].num == g->levels[level].den) return 0;
+    // keep num out of every den frames, evenly spaced
+    g->acc += g->levels[level].num;
+    if (g->acc >= g->levels[level].den) {
+        g->acc -= g->levels[level].den;
+        return 0;
+    }
+    return 1;
+}
+
+int64_t uvc_govern_interval(struct uvc_govern *g)
+{
+    return g->flags & GOVERN_FPS ? govern_level_interval(g, g->level) : g->interval;
+}
+
+int uvc_govern_bitrate(struct uvc_govern *g, int bitrate)
+{
+    return (int64_t)bitrate * g->levels[g->level].pct / 100;
+}
@@ -0,0 +1,42 @@
+#ifndef __UVC_GOVERN_H__
+#define __UVC_GOVERN_H__
+
+#include <stdint.h>
+
+#define GOVERN_MAX_LEVELS 8
+
+// rate mechanism the stream can use, at most one of them
+#define GOVERN_FPS     (1 << 0) // the producer runs at a longer interval
+#define GOVERN_SKIP    (1 << 1) // frames are dropped evenly after the producer
+#define GOVERN_BITRATE (1 << 2)
+
+// load governor, compares what building each frame costs with the interval the
+// current level delivers at and walks a ladder of lower rates, then lower bitrates,
+// while frames do not fit the budget, back up once the next level up would fit
+struct uvc_govern {
+    int      flags;
+    int      budget;     // percent of the frame interval a frame may cost
+    int64_t  interval;   // committed ns per frame
+    struct { uint8_t num, den, pct; } levels[GOVERN_MAX_LEVELS];
+    int      nlevels;
+    int      level;
+    int      acc;        // spreads skipped frames evenly
+
+    int64_t  last;       // previous frame out
+    int64_t  wstart;     // current measurement window
+    int64_t  wcost;
+    int      wframes;
+    int      wlate;
+    int      calm;       // windows in a row with room for the level above
+    int      hold;       // how many of those are needed, grows when a step up fails
+    int64_t  tup;        // when the last step up happened
+    int      underruns;  // late frames, for reporting
+};
+
+void    uvc_govern_reset   (struct uvc_govern *g, int flags, int budget, int interval); // 100ns units
+int     uvc_govern_frame   (struct uvc_govern *g, int64_t cost, int64_t now); // 1 when the level changed
+int     uvc_govern_skip    (struct uvc_govern *g); // 1: drop this frame
+int64_t uvc_govern_interval(struct uvc_govern *g); // ns per frame the producer should run at
+int     uvc_govern_bitrate (struct uvc_govern *g, int bitrate);
+
+#endif
@@ -0,0 +1,555 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uvc_pool.h"
+#include "uvc_jpeg.h"
+
+/* ---------------------------------------------------------------------------
+ * Baseline JPEG encoder for NV12 input. DCT and quantization run on eight
+ * lanes at a time using gcc vector extensions (SSE on x86, NEON on arm),
+ * entropy coding is scalar. Each restart interval is an independent slice.
+ */
+
+typedef float   v8f __attribute__((vector_size(32)));
+typedef int32_t v8i __attribute__((vector_size(32)));
+typedef uint8_t v8b __attribute__((vector_size(8)));
+
+static const uint8_t jpeg_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t jpeg_std_qt[2][64] = {
+    {
+        16, 11, 10, 16, 24 , 40 , 51 , 61 ,
+        12, 12, 14, 19, 26 , 58 , 60 , 55 ,
+        14, 13, 16, 24, 40 , 57 , 69 , 56 ,
+        14, 17, 22, 29, 51 , 87 , 80 , 62 ,
+        18, 22, 37, 56, 68 , 109, 103, 77 ,
+        24, 35, 55, 64, 81 , 104, 113, 92 ,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99 ,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+// huffman tables from ITU T.81 annex K.3: dc luma, dc chroma, ac luma, ac chroma
+static const uint8_t jpeg_huff_bits[4][16] = {
+    { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0    },
+    { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0    },
+    { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+    { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+
+static const uint8_t jpeg_huff_dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t jpeg_huff_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t jpeg_huff_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t *jpeg_huff_vals[4] = {
+    jpeg_huff_dc_vals, jpeg_huff_dc_vals, jpeg_huff_ac_luma_vals, jpeg_huff_ac_chroma_vals,
+};
+
+static const float jpeg_aan_scale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+struct jpeg_slice {
+    uint8_t *buf;
+    int      cap;
+    int      len;
+    uint8_t *scratch;
+    int      scratchcap;
+};
+
+struct jpeg_bits {
+    uint8_t *p;
+    uint8_t *end;
+    uint64_t acc;
+    int      n;
+    int      err;
+};
+
+struct uvc_jpeg {
+    struct uvc_pool   *pool;
+    int                quality;
+    uint8_t            qt[2][64];     // zigzag order, as written to DQT
+    v8f                fdtbl[2][8];   // reciprocal quantizers with aan scaling, transposed
+    uint8_t            zzt[64];       // zigzag position -> transposed coefficient index
+    uint16_t           hcode[4][256];
+    uint8_t            hsize[4][256];
+
+    struct jpeg_slice *slices;
+    int                maxslices;
+    int                nslices;
+    int                rowsper;
+
+    const uint8_t     *y;
+    const uint8_t     *uv;
+    int                width;
+    int                height;
+    int                stride;
+    int                mcux;
+    int                mcuy;
+};
+
+static void
+jpeg_build_huff(const uint8_t *bits, const uint8_t *vals, uint16_t *code, uint8_t *size)
+{
+    int l, i, k = 0, c = 0;
+    for (l=1; l<=16; l++) {
+        for (i=0; i<bits[l-1]; i++, k++, c++) {
+            code[vals[k]] = c;
+            size[vals[k]] = l;
+        }
+        c <<= 1;
+    }
+}
+
+static void
+jpeg_set_quality(struct uvc_jpeg *jpg, int quality)
+{
+    float *tbl;
+    int    t, i, u, v, q, scale;
+
+    if (quality < 1  ) quality = 1;
+    if (quality > 100) quality = 100;
+    scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (t=0; t<2; t++) {
+        tbl = (float*)jpg->fdtbl[t];
+        for (i=0; i<64; i++) {
+            q = (jpeg_std_qt[t][jpeg_zigzag[i]] * scale + 50) / 100;
+            jpg->qt[t][i] = q < 1 ? 1 : q > 255 ? 255 : q;
+        }
+        for (u=0; u<8; u++) {
+            for (v=0; v<8; v++) {
+                q = (jpeg_std_qt[t][u * 8 + v] * scale + 50) / 100;
+                q = q < 1 ? 1 : q > 255 ? 255 : q;
+                tbl[v * 8 + u] = 1.0f / (q * jpeg_aan_scale[u] * jpeg_aan_scale[v] * 8.0f);
+            }
+        }
+    }
+    jpg->quality = quality;
+}
+
+struct uvc_jpeg* uvc_jpeg_create(struct uvc_pool *pool)
+{
+    struct uvc_jpeg *jpg;
+    int i;
+
+    // the vector tables need 32 byte alignment, more than malloc() promises
+    if (posix_memalign((void**)&jpg, 32, sizeof(*jpg)) != 0) return NULL;
+    memset(jpg, 0, sizeof(*jpg));
+    jpg->pool = pool;
+    for (i=0; i<4; i++) jpeg_build_huff(jpeg_huff_bits[i], jpeg_huff_vals[i], jpg->hcode[i], jpg->hsize[i]);
+    for (i=0; i<64; i++) jpg->zzt[i] = (jpeg_zigzag[i] % 8) * 8 + jpeg_zigzag[i] / 8;
+    jpeg_set_quality(jpg, 80);
+    return jpg;
+}
+
+void uvc_jpeg_destroy(struct uvc_jpeg *jpg)
+{
+    int i;
+    if (!jpg) return;
+    for (i=0; i<jpg->maxslices; i++) free(jpg->slices[i].scratch);
+    free(jpg->slices);
+    free(jpg);
+}
+
+/* ---------------------------------------------------------------------------
+ * Transform
+ */
+
+// one aan butterfly pass, each lane is an independent 8-point dct
+static inline void
+jpeg_fdct8(v8f *d)
+{
+    v8f tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    v8f tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13;
+
+    tmp0 = d[0] + d[7]; tmp7 = d[0] - d[7];
+    tmp1 = d[1] + d[6]; tmp6 = d[1] - d[6];
+    tmp2 = d[2] + d[5]; tmp5 = d[2] - d[5];
+    tmp3 = d[3] + d[4]; tmp4 = d[3] - d[4];
+
+    tmp10 = tmp0 + tmp3; tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2; tmp12 = tmp1 - tmp2;
+    d[0]  = tmp10 + tmp11;
+    d[4]  = tmp10 - tmp11;
+    z1    = (tmp12 + tmp13) * 0.707106781f;
+    d[2]  = tmp13 + z1;
+    d[6]  = tmp13 - z1;
+
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    z5    = (tmp10 - tmp12) * 0.382683433f;
+    z2    = tmp10 * 0.541196100f + z5;
+    z4    = tmp12 * 1.306562965f + z5;
+    z3    = tmp11 * 0.707106781f;
+    z11   = tmp7 + z3;
+    z13   = tmp7 - z3;
+    d[5]  = z13 + z2;
+    d[3]  = z13 - z2;
+    d[1]  = z11 + z4;
+    d[7]  = z11 - z4;
+}
+
+static inline void
+jpeg_transpose(v8f *d)
+{
+    float t[8][8], *o = (float*)d;
+    int   i, j;
+    memcpy(t, d, sizeof(t));
+    for (i=0; i<8; i++) {
+        for (j=0; j<8; j++) o[i * 8 + j] = t[j][i];
+    }
+}
+
+// d holds level shifted samples row by row, coef receives quantized coefficients transposed
+static inline void
+jpeg_fdct_quant(v8f *d, const v8f *fdtbl, int32_t *coef)
+{
+    const v8i signmask = { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN };
+    const v8f half     = { 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f };
+    v8f q;
+    int i;
+
+    jpeg_fdct8(d);
+    jpeg_transpose(d);
+    jpeg_fdct8(d);
+    for (i=0; i<8; i++) {
+        q = d[i] * fdtbl[i];
+        q = q + (v8f)(((v8i)q & signmask) | (v8i)half);
+        *(v8i*)(coef + i * 8) = __builtin_convertvector(q, v8i);
+    }
+}
+
+static inline void
+jpeg_load_luma(v8f *d, const uint8_t *p, int stride)
+{
+    v8b b;
+    int i;
+    for (i=0; i<8; i++, p+=stride) {
+        memcpy(&b, p, 8);
+        d[i] = __builtin_convertvector(b, v8f) - 128.0f;
+    }
+}
+
+static inline void
+jpeg_load_chroma(v8f *cb, v8f *cr, const uint8_t *p, int stride)
+{
+    v8b u, v;
+    int i, j;
+    for (i=0; i<8; i++, p+=stride) {
+        for (j=0; j<8; j++) {
+            u[j] = p[j * 2 + 0];
+            v[j] = p[j * 2 + 1];
+        }
+        cb[i] = __builtin_convertvector(u, v8f) - 128.0f;
+        cr[i] = __builtin_convertvector(v, v8f) - 128.0f;
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * Entropy coding
+ */
+
+static inline void
+jpeg_bits_flush(struct jpeg_bits *bw)
+{
+    uint8_t c;
+    if (bw->p + 16 > bw->end) {
+        bw->err = 1;
+        bw->n   = 0;
+        return;
+    }
+    while (bw->n >= 8) {
+        c = bw->acc >> (bw->n - 8);
+        *bw->p++ = c;
+        if (c == 0xff) *bw->p++ = 0;
+        bw->n -= 8;
+    }
+}
+
+static inline void
+jpeg_bits_put(struct jpeg_bits *bw, uint32_t bits, int size)
+{
+    bw->acc = (bw->acc << size) | bits;
+    bw->n  += size;
+    if (bw->n >= 32) jpeg_bits_flush(bw);
+}
+
+static inline int
+jpeg_nbits(int v)
+{
+    if (v < 0) v = -v;
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+static inline void
+jpeg_encode_block(struct uvc_jpeg *jpg, struct jpeg_bits *bw, const int32_t *coef, int *pred, int comp)
+{
+    const uint16_t *dccode = jpg->hcode[comp ? 1 : 0], *accode = jpg->hcode[comp ? 3 : 2];
+    const uint8_t  *dcsize = jpg->hsize[comp ? 1 : 0], *acsize = jpg->hsize[comp ? 3 : 2];
+    int k, v, s, run = 0;
+
+    v = coef[0] - *pred;
+    *pred = coef[0];
+    s = jpeg_nbits(v);
+    if (v < 0) v--;
+    jpeg_bits_put(bw, ((uint32_t)dccode[s] << s) | (v & ((1 << s) - 1)), dcsize[s] + s);
+
+    for (k=1; k<64; k++) {
+        v = coef[jpg->zzt[k]];
+        if (v == 0) { run++; continue; }
+        while (run > 15) {
+            jpeg_bits_put(bw, accode[0xf0], acsize[0xf0]);
+            run -= 16;
+        }
+        s = jpeg_nbits(v);
+        if (v < 0) v--;
+        jpeg_bits_put(bw, ((uint32_t)accode[(run << 4) | s] << s) | (v & ((1 << s) - 1)), acsize[(run << 4) | s] + s);
+        run = 0;
+    }
+    if (run) jpeg_bits_put(bw, accode[0x00], acsize[0x00]);
+}
+
+static void
+jpeg_encode_mcu(struct uvc_jpeg *jpg, struct jpeg_bits *bw, int mx, int my, int *pred)
+{
+    uint8_t        ytmp[16 * 16], uvtmp[16 * 8];
+    const uint8_t *py, *puv;
+    int32_t        coef[64] __attribute__((aligned(32)));
+    v8f            d[8], cr[8];
+    int            x0 = mx * 16, y0 = my * 16, ys, uvs, i, j, xx, yy;
+
+    if (x0 + 16 <= jpg->width && y0 + 16 <= jpg->height) {
+        py  = jpg->y  + y0 * jpg->stride + x0;
+        puv = jpg->uv + y0 / 2 * jpg->stride + x0;
+        ys  = uvs = jpg->stride;
+    } else { // replicate the right and bottom edges
+        for (i=0; i<16; i++) {
+            yy = y0 + i < jpg->height ? y0 + i : jpg->height - 1;
+            for (j=0; j<16; j++) {
+                xx = x0 + j < jpg->width ? x0 + j : jpg->width - 1;
+                ytmp[i * 16 + j] = jpg->y[yy * jpg->stride + xx];
+            }
+        }
+        for (i=0; i<8; i++) {
+            yy = y0 / 2 + i < (jpg->height + 1) / 2 ? y0 / 2 + i : (jpg->height + 1) / 2 - 1;
+            for (j=0; j<8; j++) {
+                xx = x0 / 2 + j < (jpg->width + 1) / 2 ? x0 / 2 + j : (jpg->width + 1) / 2 - 1;
+                uvtmp[i * 16 + j * 2 + 0] = jpg->uv[yy * jpg->stride + xx * 2 + 0];
+                uvtmp[i * 16 + j * 2 + 1] = jpg->uv[yy * jpg->stride + xx * 2 + 1];
+            }
+        }
+        py  = ytmp;
+        puv = uvtmp;
+        ys  = uvs = 16;
+    }
+
+    for (i=0; i<4; i++) {
+        jpeg_load_luma(d, py + (i >> 1) * 8 * ys + (i & 1) * 8, ys);
+        jpeg_fdct_quant(d, jpg->fdtbl[0], coef);
+        jpeg_encode_block(jpg, bw, coef, &pred[0], 0);
+    }
+    jpeg_load_chroma(d, cr, puv, uvs);
+    jpeg_fdct_quant(d , jpg->fdtbl[1], coef);
+    jpeg_encode_block(jpg, bw, coef, &pred[1], 1);
+    jpeg_fdct_quant(cr, jpg->fdtbl[1], coef);
+    jpeg_encode_block(jpg, bw, coef, &pred[2], 2);
+}
+
+static void
+jpeg_slice_proc(void *ctxt, int job)
+{
+    struct uvc_jpeg   *jpg = (struct uvc_jpeg*)ctxt;
+    struct jpeg_slice *sl  = &jpg->slices[job];
+    struct jpeg_bits   bw  = { sl->buf, sl->buf + sl->cap, 0, 0, 0 };
+    int pred[3] = { 0, 0, 0 }, mx, my, ymax, pad;
+
+    ymax = (job + 1) * jpg->rowsper;
+    if (ymax > jpg->mcuy) ymax = jpg->mcuy;
+    for (my=job*jpg->rowsper; my<ymax && !bw.err; my++) {
+        for (mx=0; mx<jpg->mcux; mx++) jpeg_encode_mcu(jpg, &bw, mx, my, pred);
+    }
+
+    pad = (8 - (bw.n & 7)) & 7;
+    jpeg_bits_put  (&bw, (1 << pad) - 1, pad);
+    jpeg_bits_flush(&bw);
+    if (job != jpg->nslices - 1 && !bw.err) {
+        if (bw.p + 2 > bw.end) bw.err = 1;
+        else {
+            *bw.p++ = 0xff;
+            *bw.p++ = 0xd0 + (job & 7);
+        }
+    }
+    sl->len = bw.err ? -1 : bw.p - sl->buf;
+}
+
+/* ---------------------------------------------------------------------------
+ * Headers
+ */
+
+static uint8_t*
+jpeg_put_marker(uint8_t *p, int marker, int len)
+{
+    *p++ = 0xff;
+    *p++ = marker;
+    if (len) {
+        *p++ = len >> 8;
+        *p++ = len & 0xff;
+    }
+    return p;
+}
+
+static int
+jpeg_write_header(struct uvc_jpeg *jpg, uint8_t *dst)
+{
+    static const uint8_t jfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    uint8_t *p = dst;
+    int i, n;
+
+    p = jpeg_put_marker(p, 0xd8, 0);
+    p = jpeg_put_marker(p, 0xe0, 2 + sizeof(jfif));
+    memcpy(p, jfif, sizeof(jfif)); p += sizeof(jfif);
+
+    p = jpeg_put_marker(p, 0xdb, 2 + 65 * 2);
+    for (i=0; i<2; i++) {
+        *p++ = i;
+        memcpy(p, jpg->qt[i], 64); p += 64;
+    }
+
+    p = jpeg_put_marker(p, 0xc0, 17);
+    *p++ = 8;
+    *p++ = jpg->height >> 8; *p++ = jpg->height & 0xff;
+    *p++ = jpg->width  >> 8; *p++ = jpg->width  & 0xff;
+    *p++ = 3;
+    *p++ = 1; *p++ = 0x22; *p++ = 0;
+    *p++ = 2; *p++ = 0x11; *p++ = 1;
+    *p++ = 3; *p++ = 0x11; *p++ = 1;
+
+    p = jpeg_put_marker(p, 0xc4, 2 + (1 + 16 + 12) * 2 + (1 + 16 + 162) * 2);
+    for (i=0; i<4; i++) {
+        *p++ = (i >> 1) << 4 | (i & 1);
+        memcpy(p, jpeg_huff_bits[i], 16); p += 16;
+        n = i < 2 ? 12 : 162;
+        memcpy(p, jpeg_huff_vals[i], n); p += n;
+    }
+
+    p = jpeg_put_marker(p, 0xdd, 4);
+    n = jpg->rowsper * jpg->mcux;
+    *p++ = n >> 8; *p++ = n & 0xff;
+
+    p = jpeg_put_marker(p, 0xda, 12);
+    *p++ = 3;
+    *p++ = 1; *p++ = 0x00;
+    *p++ = 2; *p++ = 0x11;
+    *p++ = 3; *p++ = 0x11;
+    *p++ = 0; *p++ = 63; *p++ = 0;
+    return p - dst;
+}
+
+#define JPEG_HEADER_MAX 1024
+
+int uvc_jpeg_encode(struct uvc_jpeg *jpg, uint8_t *dst, int dstlen,
+                    const uint8_t *y, const uint8_t *uv, int width, int height, int stride, int quality)
+{
+    struct jpeg_slice *sl;
+    int hdr, pos, i, nslices, cap;
+
+    if (width <= 0 || height <= 0 || dstlen < JPEG_HEADER_MAX) return -1;
+    if (quality != jpg->quality) jpeg_set_quality(jpg, quality);
+
+    jpg->y      = y;
+    jpg->uv     = uv;
+    jpg->width  = width;
+    jpg->height = height;
+    jpg->stride = stride;
+    jpg->mcux   = (width  + 15) / 16;
+    jpg->mcuy   = (height + 15) / 16;
+
+    // two slices per worker keeps the cores busy when slice costs differ
+    nslices = uvc_pool_size(jpg->pool) * 2;
+    if (nslices > jpg->mcuy) nslices = jpg->mcuy;
+    jpg->rowsper = (jpg->mcuy + nslices - 1) / nslices;
+    if (jpg->rowsper * jpg->mcux > 0xffff) jpg->rowsper = 0xffff / jpg->mcux;
+    jpg->nslices = (jpg->mcuy + jpg->rowsper - 1) / jpg->rowsper;
+
+    if (jpg->nslices > jpg->maxslices) {
+        sl = realloc(jpg->slices, jpg->nslices * sizeof(*sl));
+        if (!sl) return -1;
+        memset(sl + jpg->maxslices, 0, (jpg->nslices - jpg->maxslices) * sizeof(*sl));
+        jpg->slices    = sl;
+        jpg->maxslices = jpg->nslices;
+    }
+
+    // slice 0 is coded straight into dst, the others into scratch sized to the raw slice
+    hdr = jpeg_write_header(jpg, dst);
+    cap = jpg->rowsper * 16 * jpg->mcux * 16 * 3 / 2 + 1024;
+    for (i=0; i<jpg->nslices; i++) {
+        sl = &jpg->slices[i];
+        if (i == 0) {
+            sl->buf = dst + hdr;
+            sl->cap = dstlen - hdr - 2;
+            continue;
+        }
+        if (sl->scratchcap < cap) {
+            free(sl->scratch);
+            sl->scratch    = malloc(cap);
+            sl->scratchcap = sl->scratch ? cap : 0;
+            if (!sl->scratch) return -1;
+        }
+        sl->buf = sl->scratch;
+        sl->cap = cap;
+    }
+
+    uvc_pool_run(jpg->pool, jpeg_slice_proc, jpg, jpg->nslices);
+
+    pos = hdr;
+    for (i=0; i<jpg->nslices; i++) {
+        sl = &jpg->slices[i];
+        if (sl->len < 0 || pos + sl->len > dstlen - 2) return -1;
+        if (i) memcpy(dst + pos, sl->buf, sl->len);
+        pos += sl->len;
+    }
+    jpeg_put_marker(dst + pos, 0xd9, 0);
+    return pos + 2;
+}
@@ -0,0 +1,18 @@
+#ifndef __UVC_JPEG_H__
+#define __UVC_JPEG_H__
+
+#include <stdint.h>
+
+struct uvc_pool;
+struct uvc_jpeg;
+
+struct uvc_jpeg* uvc_jpeg_create (struct uvc_pool *pool);
+void             uvc_jpeg_destroy(struct uvc_jpeg *jpg);
+
+// encode one NV12 picture as baseline 4:2:0 JPEG into dst, the picture is cut into
+// restart-interval slices that are entropy coded in parallel on the pool,
+// returns the JPEG size or -1 if it does not fit into dstlen
+int uvc_jpeg_encode(struct uvc_jpeg *jpg, uint8_t *dst, int dstlen,
+                    const uint8_t *y, const uint8_t *uv, int width, int height, int stride, int quality);
+
+#endif
@@ -0,0 +1,334 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "uvc_osd.h"
+
+/* ---------------------------------------------------------------------------
+ * Layers live in frame coordinates on even positions, their luma and chroma
+ * planes are kept premultiplied with a separate alpha so that blending is one
+ * multiply-add per byte. Setting a layer renders it 2x2 pixels at a time, a
+ * text that changes only redraws the cells that differ.
+ */
+
+#define OSD_MAX_TEXT 64
+
+typedef uint8_t  v16b __attribute__((vector_size(16)));
+typedef uint16_t v16h __attribute__((vector_size(32)));
+
+// 5x7 ascii 0x20..0x7e, one byte per column, bit 0 at the top
+static const uint8_t g_osd_font[95][5] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5f,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7f,0x14,0x7f,0x14},
+    {0x24,0x2a,0x7f,0x2a,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x56,0x20,0x50}, {0x00,0x05,0x03,0x00,0x00},
+    {0x00,0x1c,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1c,0x00}, {0x2a,0x1c,0x7f,0x1c,0x2a}, {0x08,0x08,0x3e,0x08,0x08},
+    {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02},
+    {0x3e,0x51,0x49,0x45,0x3e}, {0x00,0x42,0x7f,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4b,0x31},
+    {0x18,0x14,0x12,0x7f,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3c,0x4a,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03},
+    {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1e}, {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00},
+    {0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06},
+    {0x32,0x49,0x79,0x41,0x3e}, {0x7e,0x11,0x11,0x11,0x7e}, {0x7f,0x49,0x49,0x49,0x36}, {0x3e,0x41,0x41,0x41,0x22},
+    {0x7f,0x41,0x41,0x22,0x1c}, {0x7f,0x49,0x49,0x49,0x41}, {0x7f,0x09,0x09,0x09,0x01}, {0x3e,0x41,0x49,0x49,0x7a},
+    {0x7f,0x08,0x08,0x08,0x7f}, {0x00,0x41,0x7f,0x41,0x00}, {0x20,0x40,0x41,0x3f,0x01}, {0x7f,0x08,0x14,0x22,0x41},
+    {0x7f,0x40,0x40,0x40,0x40}, {0x7f,0x02,0x0c,0x02,0x7f}, {0x7f,0x04,0x08,0x10,0x7f}, {0x3e,0x41,0x41,0x41,0x3e},
+    {0x7f,0x09,0x09,0x09,0x06}, {0x3e,0x41,0x51,0x21,0x5e}, {0x7f,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31},
+    {0x01,0x01,0x7f,0x01,0x01}, {0x3f,0x40,0x40,0x40,0x3f}, {0x1f,0x20,0x40,0x20,0x1f}, {0x3f,0x40,0x38,0x40,0x3f},
+    {0x63,0x14,0x08,0x14,0x63}, {0x07,0x08,0x70,0x08,0x07}, {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7f,0x41,0x41,0x00},
+    {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7f,0x00}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+    {0x00,0x01,0x02,0x04,0x00}, {0x20,0x54,0x54,0x54,0x78}, {0x7f,0x48,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x20},
+    {0x38,0x44,0x44,0x48,0x7f}, {0x38,0x54,0x54,0x54,0x18}, {0x08,0x7e,0x09,0x01,0x02}, {0x0c,0x52,0x52,0x52,0x3e},
+    {0x7f,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7d,0x40,0x00}, {0x20,0x40,0x44,0x3d,0x00}, {0x7f,0x10,0x28,0x44,0x00},
+    {0x00,0x41,0x7f,0x40,0x00}, {0x7c,0x04,0x18,0x04,0x78}, {0x7c,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+    {0x7c,0x14,0x14,0x14,0x08}, {0x08,0x14,0x14,0x18,0x7c}, {0x7c,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x20},
+    {0x04,0x3f,0x44,0x40,0x20}, {0x3c,0x40,0x40,0x20,0x7c}, {0x1c,0x20,0x40,0x20,0x1c}, {0x3c,0x40,0x30,0x40,0x3c},
+    {0x44,0x28,0x10,0x28,0x44}, {0x0c,0x50,0x50,0x50,0x3c}, {0x44,0x64,0x54,0x4c,0x44}, {0x00,0x08,0x36,0x41,0x00},
+    {0x00,0x00,0x7f,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00}, {0x10,0x08,0x08,0x10,0x08},
+};
+
+struct osd_layer {
+    int       x, y, w, h;
+    int       opaque;      // every alpha is 255, blended by plain copies
+    uint8_t  *py, *ay;     // w x h
+    uint8_t  *puv, *auv;   // w x h / 2, interleaved like the nv12 chroma plane
+
+    // text layers have a scale, fg is also the mask color
+    char      text[OSD_MAX_TEXT];
+    int       scale;
+    uint32_t  fg, bg;
+    // bitmap source, only while rendering
+    const uint8_t *rgba;
+    int       bw, bh;
+};
+
+struct uvc_osd {
+    pthread_mutex_t  mutex;
+    struct osd_layer layers[OSD_MAX_LAYERS];
+    int              nactive;
+};
+
+typedef uint32_t (*osd_sampler)(const struct osd_layer *l, int x, int y);
+
+static void
+osd_layer_free(struct osd_layer *l)
+{
+    free(l->py);
+    free(l->puv);
+    memset(l, 0, sizeof(*l));
+}
+
+// buffers are kept when the size does not change
+static int
+osd_layer_alloc(struct uvc_osd *osd, struct osd_layer *l, int x, int y, int w, int h)
+{
+    w = (w + 1) & ~1;
+    h = (h + 1) & ~1;
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > 4096 || h > 4096) return -1;
+    if (l->w != w || l->h != h) {
+        if (l->w) osd->nactive--;
+        osd_layer_free(l);
+        l->py  = malloc(w * h * 2);
+        l->puv = malloc(w * h);
+        if (!l->py || !l->puv) {
+            osd_layer_free(l);
+            return -1;
+        }
+        l->ay  = l->py  + w * h;
+        l->auv = l->puv + w * h / 2;
+        l->w   = w;
+        l->h   = h;
+        osd->nactive++;
+    }
+    l->x = x & ~1;
+    l->y = y & ~1;
+    return 0;
+}
+
+static uint32_t
+osd_rgba_to_ayuv(const uint8_t *p)
+{
+    int y = ( 66 * p[0] + 129 * p[1] +  25 * p[2] + 128) / 256 + 16;
+    int u = (-38 * p[0] -  74 * p[1] + 112 * p[2] + 128) / 256 + 128;
+    int v = (112 * p[0] -  94 * p[1] -  18 * p[2] + 128) / 256 + 128;
+    return (uint32_t)p[3] << 24 | y << 16 | u << 8 | v;
+}
+
+static uint32_t
+osd_sample_bitmap(const struct osd_layer *l, int x, int y)
+{
+    // odd sizes are padded to even with transparent pixels
+    if (x >= l->bw || y >= l->bh) return 0;
+    return osd_rgba_to_ayuv(l->rgba + (y * l->bw + x) * 4);
+}
+
+static uint32_t
+osd_sample_fill(const struct osd_layer *l, int x, int y)
+{
+    (void)x;
+    (void)y;
+    return l->fg;
+}
+
+static uint32_t
+osd_sample_text(const struct osd_layer *l, int x, int y)
+{
+    int cw = 6 * l->scale, c = x / cw, col = x % cw / l->scale, row = y / l->scale;
+    unsigned char ch = l->text[c];
+
+    if (ch < 0x20 || ch > 0x7e) ch = '?';
+    return col < 5 && row < 7 && (g_osd_font[ch - 0x20][col] >> row & 1) ? l->fg : l->bg;
+}
+
+// render the even aligned rect [x0, x1) x [y0, y1) of a layer, 2x2 pixels at a time
+static void
+osd_render(struct osd_layer *l, int x0, int y0, int x1, int y1, osd_sampler sample)
+{
+    uint32_t c[4];
+    int x, y, k, a, au, pu, pv, ox, oy;
+
+    for (y=y0; y<y1; y+=2) {
+        for (x=x0; x<x1; x+=2) {
+            au = pu = pv = 0;
+            for (k=0; k<4; k++) {
+                ox = k & 1; oy = k >> 1;
+                c[k] = sample(l, x + ox, y + oy);
+                a    = c[k] >> 24;
+                l->py[(y + oy) * l->w + x + ox] = ((c[k] >> 16 & 0xff) * a + 127) / 255;
+                l->ay[(y + oy) * l->w + x + ox] = a;
+                au  += a;
+                pu  += (c[k] >> 8 & 0xff) * a;
+                pv  += (c[k] >> 0 & 0xff) * a;
+            }
+            l->puv[y / 2 * l->w + x + 0] = (pu + 510) / 1020;
+            l->puv[y / 2 * l->w + x + 1] = (pv + 510) / 1020;
+            l->auv[y / 2 * l->w + x + 0] = (au + 2) / 4;
+            l->auv[y / 2 * l->w + x + 1] = (au + 2) / 4;
+        }
+    }
+}
+
+static void
+osd_update_opaque(struct osd_layer *l)
+{
+    int i;
+    for (i=0; i<l->w * l->h && l->ay[i] == 255; i++);
+    l->opaque = i == l->w * l->h;
+}
+
+struct uvc_osd* uvc_osd_create(void)
+{
+    struct uvc_osd *osd = calloc(1, sizeof(*osd));
+    if (osd) pthread_mutex_init(&osd->mutex, NULL);
+    return osd;
+}
+
+void uvc_osd_destroy(struct uvc_osd *osd)
+{
+    int i;
+    if (!osd) return;
+    for (i=0; i<OSD_MAX_LAYERS; i++) osd_layer_free(&osd->layers[i]);
+    pthread_mutex_destroy(&osd->mutex);
+    free(osd);
+}
+
+int uvc_osd_active(struct uvc_osd *osd)
+{
+    return osd && osd->nactive > 0;
+}
+
+int uvc_osd_text(struct uvc_osd *osd, int layer, int x, int y, int scale, uint32_t fg, uint32_t bg, const char *text)
+{
+    struct osd_layer *l;
+    int n = strlen(text), first, last;
+
+    if (layer < 0 || layer >= OSD_MAX_LAYERS || scale < 1 || scale > 8 || n <= 0 || n >= OSD_MAX_TEXT) return -1;
+    l = &osd->layers[layer];
+    pthread_mutex_lock(&osd->mutex);
+    if (l->w && l->scale == scale && l->fg == fg && l->bg == bg && (int)strlen(l->text) == n) {
+        // same geometry and colors, only the cells that changed are drawn again
+        for (first=0; first<n && l->text[first] == text[first]; first++);
+        for (last=n-1; last>=first && l->text[last] == text[last]; last--);
+        strcpy(l->text, text);
+        l->x = x & ~1;
+        l->y = y & ~1;
+        if (first <= last) osd_render(l, first * 6 * scale, 0, (last + 1) * 6 * scale, l->h, osd_sample_text);
+    } else {
+        if (osd_layer_alloc(osd, l, x, y, n * 6 * scale, 8 * scale) < 0) {
+            pthread_mutex_unlock(&osd->mutex);
+            return -1;
+        }
+        strcpy(l->text, text);
+        l->scale = scale;
+        l->fg    = fg;
+        l->bg    = bg;
+        osd_render(l, 0, 0, l->w, l->h, osd_sample_text);
+        l->opaque = (fg >> 24) == 255 && (bg >> 24) == 255;
+    }
+    pthread_mutex_unlock(&osd->mutex);
+    return 0;
+}
+
+int uvc_osd_bitmap(struct uvc_osd *osd, int layer, int x, int y, int w, int h, const uint8_t *rgba)
+{
+    struct osd_layer *l;
+
+    if (layer < 0 || layer >= OSD_MAX_LAYERS || !rgba) return -1;
+    l = &osd->layers[layer];
+    pthread_mutex_lock(&osd->mutex);
+    if (osd_layer_alloc(osd, l, x, y, w, h) < 0) {
+        pthread_mutex_unlock(&osd->mutex);
+        return -1;
+    }
+    l->scale = 0;
+    l->rgba  = rgba;
+    l->bw    = w;
+    l->bh    = h;
+    osd_render(l, 0, 0, l->w, l->h, osd_sample_bitmap);
+    osd_update_opaque(l);
+    l->rgba  = NULL;
+    pthread_mutex_unlock(&osd->mutex);
+    return 0;
+}
+
+int uvc_osd_mask(struct uvc_osd *osd, int layer, int x, int y, int w, int h, uint32_t color)
+{
+    struct osd_layer *l;
+
+    if (layer < 0 || layer >= OSD_MAX_LAYERS) return -1;
+    l = &osd->layers[layer];
+    pthread_mutex_lock(&osd->mutex);
+    if (osd_layer_alloc(osd, l, x, y, w, h) < 0) {
+        pthread_mutex_unlock(&osd->mutex);
+        return -1;
+    }
+    l->scale  = 0;
+    l->fg     = color;
+    osd_render(l, 0, 0, l->w, l->h, osd_sample_fill);
+    l->opaque = (color >> 24) == 255;
+    pthread_mutex_unlock(&osd->mutex);
+    return 0;
+}
+
+int uvc_osd_clear(struct uvc_osd *osd, int layer)
+{
+    if (layer < 0 || layer >= OSD_MAX_LAYERS) return -1;
+    pthread_mutex_lock(&osd->mutex);
+    if (osd->layers[layer].w) osd->nactive--;
+    osd_layer_free(&osd->layers[layer]);
+    pthread_mutex_unlock(&osd->mutex);
+    return 0;
+}
+
+// d = p + d * (256 - a') / 256 with a' = a + a / 128, sixteen bytes at a time,
+// runs that are fully transparent are skipped
+static void
+osd_blend_row(uint8_t *d, const uint8_t *p, const uint8_t *a, int n)
+{
+    uint64_t t[2];
+    v16h     vd, va, vr;
+    v16b     v;
+    unsigned int r;
+    int      i;
+
+    for (i=0; i+16<=n; i+=16) {
+        memcpy(t, a + i, 16);
+        if (!(t[0] | t[1])) continue;
+        memcpy(&v, a + i, 16);
+        va = __builtin_convertvector(v, v16h);
+        memcpy(&v, d + i, 16);
+        vd = __builtin_convertvector(v, v16h);
+        memcpy(&v, p + i, 16);
+        vr = __builtin_convertvector(v, v16h) + ((vd * (256 - va - (va >> 7)) + 128) >> 8);
+        vr -= vr >> 8;
+        v  = __builtin_convertvector(vr, v16b);
+        memcpy(d + i, &v, 16);
+    }
+    for (; i<n; i++) {
+        r    = p[i] + ((d[i] * (256 - a[i] - (a[i] >> 7)) + 128) >> 8);
+        d[i] = r - (r >> 8);
+    }
+}
+
+void uvc_osd_blend(struct uvc_osd *osd, uint8_t *y, uint8_t *uv, int width, int height, int stride)
+{
+    struct osd_layer *l;
+    int i, j, x0, y0, x1, y1;
+
+    if (!osd || !osd->nactive) return;
+    pthread_mutex_lock(&osd->mutex);
+    for (i=0; i<OSD_MAX_LAYERS; i++) {
+        l  = &osd->layers[i];
+        x0 = l->x;
+        y0 = l->y;
+        x1 = l->x + l->w < width  ? l->x + l->w : width  & ~1;
+        y1 = l->y + l->h < height ? l->y + l->h : height & ~1;
+        if (!l->w || x0 >= x1 || y0 >= y1) continue;
+        for (j=y0; j<y1; j++) {
+            if (l->opaque) memcpy(y + j * stride + x0, l->py + (j - l->y) * l->w, x1 - x0);
+            else osd_blend_row(y + j * stride + x0, l->py + (j - l->y) * l->w, l->ay + (j - l->y) * l->w, x1 - x0);
+        }
+        for (j=y0/2; j<y1/2; j++) {
+            if (l->opaque) memcpy(uv + j * stride + x0, l->puv + (j - l->y / 2) * l->w, x1 - x0);
+            else osd_blend_row(uv + j * stride + x0, l->puv + (j - l->y / 2) * l->w, l->auv + (j - l->y / 2) * l->w, x1 - x0);
+        }
+    }
+    pthread_mutex_unlock(&osd->mutex);
+}
@@ -0,0 +1,24 @@
+#ifndef __UVC_OSD_H__
+#define __UVC_OSD_H__
+
+#include <stdint.h>
+
+#define OSD_MAX_LAYERS 8
+
+// overlay layers burned into NV12 pictures, each is rendered once into a premultiplied
+// cache when set, colors are 0xAAYYUUVV
+struct uvc_osd;
+
+struct uvc_osd* uvc_osd_create (void);
+void            uvc_osd_destroy(struct uvc_osd *osd);
+int             uvc_osd_active (struct uvc_osd *osd); // osd may be NULL
+
+int  uvc_osd_text  (struct uvc_osd *osd, int layer, int x, int y, int scale, uint32_t fg, uint32_t bg, const char *text);
+int  uvc_osd_bitmap(struct uvc_osd *osd, int layer, int x, int y, int w, int h, const uint8_t *rgba);
+int  uvc_osd_mask  (struct uvc_osd *osd, int layer, int x, int y, int w, int h, uint32_t color);
+int  uvc_osd_clear (struct uvc_osd *osd, int layer);
+
+// blend every layer over the picture, touches only the area the layers cover
+void uvc_osd_blend (struct uvc_osd *osd, uint8_t *y, uint8_t *uv, int width, int height, int stride);
+
+#endif
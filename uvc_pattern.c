@@ -0,0 +1,244 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include "uvc_source.h"
+
+/* ---------------------------------------------------------------------------
+ * Test patterns drawn straight in NV12 or packed 4:2:2. Bars are static and
+ * drawn once per start, the ramp is a memcpy per row out of a longer ramp,
+ * noise is a vectorized xorshift. The counter bands carry the frame number,
+ * the second band inverted so that a misread is caught.
+ */
+
+#define PATTERN_BITS  32
+#define PATTERN_BAND  16 // rows per counter band
+
+typedef uint32_t v4u __attribute__((vector_size(16)));
+
+struct uvc_pattern {
+    struct uvc_source src;
+    int               pattern;
+    int               counter;
+    unsigned int      fcc;   // NV12, YUYV or UYVY
+    int               width;
+    int               height;
+    uint8_t          *buf;
+    int               bufsize;
+    uint8_t          *ramp;  // one ramp row plus 256 pixels to slide through
+    uint32_t          frame;
+    v4u               seed;
+};
+
+// 75% bars, white yellow cyan green magenta red blue black
+static const uint8_t g_pattern_bars[8][3] = {
+    { 180, 128, 128 }, { 162,  44, 142 }, { 131, 156,  44 }, { 112,  72,  58 },
+    {  84, 184, 198 }, {  65, 100, 212 }, {  35, 212, 114 }, {  16, 128, 128 },
+};
+
+static int
+pattern_packed(const struct uvc_pattern *pt)
+{
+    return pt->fcc != V4L2_PIX_FMT_NV12;
+}
+
+// write pixel x of a row, uv is where the chroma of that row lives
+static void
+pattern_put(const struct uvc_pattern *pt, uint8_t *row, uint8_t *uv, int x, const uint8_t *yuv)
+{
+    int yfirst = pt->fcc == V4L2_PIX_FMT_YUYV;
+
+    if (!pattern_packed(pt)) {
+        row[x] = yuv[0];
+        if (uv) uv[x] = yuv[1 + (x & 1)];
+    } else {
+        row[2 * x + !yfirst] = yuv[0];
+        row[2 * x +  yfirst] = yuv[1 + (x & 1)];
+    }
+}
+
+static int
+pattern_size(const struct uvc_pattern *pt)
+{
+    return pattern_packed(pt) ? pt->width * pt->height * 2 : pt->width * pt->height * 3 / 2;
+}
+
+static uint8_t*
+pattern_row(const struct uvc_pattern *pt, int y)
+{
+    return pt->buf + y * pt->width * (pattern_packed(pt) ? 2 : 1);
+}
+
+static uint8_t*
+pattern_uvrow(const struct uvc_pattern *pt, int y)
+{
+    return pattern_packed(pt) || (y & 1) ? NULL : pt->buf + pt->width * pt->height + y / 2 * pt->width;
+}
+
+static void
+pattern_draw_bars(struct uvc_pattern *pt)
+{
+    int x, y, rowlen = pt->width * (pattern_packed(pt) ? 2 : 1);
+
+    for (x=0; x<pt->width; x++) {
+        pattern_put(pt, pattern_row(pt, 0), pattern_uvrow(pt, 0), x, g_pattern_bars[x * 8 / pt->width]);
+    }
+    for (y=1; y<pt->height; y++) memcpy(pattern_row(pt, y), pattern_row(pt, 0), rowlen);
+    if (!pattern_packed(pt)) {
+        for (y=2; y<pt->height; y+=2) memcpy(pattern_uvrow(pt, y), pattern_uvrow(pt, 0), pt->width);
+    }
+}
+
+// a diagonal luma ramp moving one pixel per frame, chroma stays neutral
+static void
+pattern_draw_ramp(struct uvc_pattern *pt)
+{
+    int y, off, px = pattern_packed(pt) ? 2 : 1;
+
+    for (y=0; y<pt->height; y++) {
+        off = (y + pt->frame) & 255;
+        memcpy(pattern_row(pt, y), pt->ramp + off * px, pt->width * px);
+    }
+    if (!pattern_packed(pt)) memset(pt->buf + pt->width * pt->height, 128, pt->width * pt->height / 2);
+}
+
+static void
+pattern_draw_noise(struct uvc_pattern *pt)
+{
+    int  n = pattern_size(pt), i;
+    v4u  s = pt->seed;
+
+    for (i=0; i+16<=n; i+=16) {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        memcpy(pt->buf + i, &s, 16);
+    }
+    memcpy(pt->buf + i, &s, n - i);
+    pt->seed = s;
+}
+
+static void
+pattern_draw_counter(struct uvc_pattern *pt)
+{
+    static const uint8_t on[3] = { 235, 128, 128 }, off[3] = { 16, 128, 128 };
+    int x, y, bit, bw = pt->width / PATTERN_BITS;
+
+    for (y=0; y<PATTERN_BAND * 2 && y<pt->height; y++) {
+        for (x=0; x<bw * PATTERN_BITS; x++) {
+            bit = pt->frame >> (PATTERN_BITS - 1 - x / bw) & 1;
+            if (y >= PATTERN_BAND) bit = !bit;
+            pattern_put(pt, pattern_row(pt, y), pattern_uvrow(pt, y), x, bit ? on : off);
+        }
+    }
+}
+
+static int
+pattern_start(struct uvc_source *src, unsigned int fcc, int width, int height)
+{
+    struct uvc_pattern *pt = (struct uvc_pattern*)src;
+    int i, size;
+
+    switch (fcc) {
+    case V4L2_PIX_FMT_NV12 :
+    case V4L2_PIX_FMT_MJPEG: pt->fcc = V4L2_PIX_FMT_NV12; size = width * height * 3 / 2; break;
+    case V4L2_PIX_FMT_YUYV :
+    case V4L2_PIX_FMT_UYVY : pt->fcc = fcc; size = width * height * 2; break;
+    default:
+        printf("pattern: no generator for %.4s !\n", (char*)&fcc);
+        return -1;
+    }
+    if (width < PATTERN_BITS || height < 2 || (width & 1) || (height & 1)) return -1;
+    if (pt->bufsize < size) {
+        free(pt->buf);
+        pt->buf     = malloc(size);
+        pt->bufsize = pt->buf ? size : 0;
+        if (!pt->buf) return -1;
+    }
+    free(pt->ramp);
+    pt->ramp = malloc((width + 256) * 2);
+    if (!pt->ramp) return -1;
+    pt->width  = width;
+    pt->height = height;
+    pt->frame  = 0;
+    for (i=0; i<width+256; i++) {
+        if (pattern_packed(pt)) {
+            pt->ramp[2 * i + (fcc != V4L2_PIX_FMT_YUYV)] = i;
+            pt->ramp[2 * i + (fcc == V4L2_PIX_FMT_YUYV)] = 128;
+        } else {
+            pt->ramp[i] = i;
+        }
+    }
+    if (pt->pattern == CAMUVC_PATTERN_BARS) pattern_draw_bars(pt);
+    return 0;
+}
+
+static int
+pattern_read(struct uvc_source *src, struct camuvc_frame *frame)
+{
+    struct uvc_pattern *pt = (struct uvc_pattern*)src;
+
+    if (!pt->buf) return -1;
+    switch (pt->pattern) {
+    case CAMUVC_PATTERN_RAMP : pattern_draw_ramp (pt); break;
+    case CAMUVC_PATTERN_NOISE: pattern_draw_noise(pt); break;
+    }
+    if (pt->counter) pattern_draw_counter(pt);
+
+    memset(frame, 0, sizeof(*frame));
+    frame->data   = pt->buf;
+    frame->len    = pattern_size(pt);
+    frame->fcc    = pt->fcc;
+    frame->width  = pt->width;
+    frame->height = pt->height;
+    frame->uoff   = pattern_packed(pt) ? 0 : pt->width * pt->height;
+    pt->frame++;
+    return 0;
+}
+
+static void
+pattern_close(struct uvc_source *src)
+{
+    struct uvc_pattern *pt = (struct uvc_pattern*)src;
+    free(pt->ramp);
+    free(pt->buf);
+    free(pt);
+}
+
+struct uvc_source* uvc_pattern_open(int pattern, int fast)
+{
+    struct uvc_pattern *pt;
+
+    if ((pattern & 0xff) > CAMUVC_PATTERN_NOISE) return NULL;
+    pt = calloc(1, sizeof(*pt));
+    if (!pt) return NULL;
+    pt->pattern   = pattern & 0xff;
+    pt->counter   = !!(pattern & CAMUVC_PATTERN_COUNTER);
+    pt->seed      = (v4u){ 0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35 };
+    pt->src.paced = !fast;
+    pt->src.start = pattern_start;
+    pt->src.read  = pattern_read;
+    pt->src.close = pattern_close;
+    return &pt->src;
+}
+
+int64_t camuvc_pattern_counter(const uint8_t *data, unsigned int fcc, int width, int height)
+{
+    uint32_t value = 0, check = 0;
+    int i, x, bw = width / PATTERN_BITS, px, yoff;
+
+    if (!data || bw <= 0 || height < PATTERN_BAND * 2) return -1;
+    switch (fcc) {
+    case V4L2_PIX_FMT_NV12: px = 1; yoff = 0; break;
+    case V4L2_PIX_FMT_YUYV: px = 2; yoff = 0; break;
+    case V4L2_PIX_FMT_UYVY: px = 2; yoff = 1; break;
+    default: return -1;
+    }
+    for (i=0; i<PATTERN_BITS; i++) {
+        x = i * bw + bw / 2;
+        value = value << 1 | (data[(PATTERN_BAND / 2)                * width * px + x * px + yoff] >= 128);
+        check = check << 1 | (data[(PATTERN_BAND + PATTERN_BAND / 2) * width * px + x * px + yoff] >= 128);
+    }
+    return value == (uint32_t)~check ? (int64_t)value : -1;
+}
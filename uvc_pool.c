@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "uvc_pool.h"
+
+#define POOL_MAX_THREADS 16
+
+struct uvc_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    pthread_cond_t  done;
+    pthread_mutex_t runlock;
+    pthread_t       threads[POOL_MAX_THREADS];
+    int             nthreads;
+    int             exit;
+
+    unsigned int    gen;
+    void          (*fn)(void *ctxt, int job);
+    void           *ctxt;
+    int             njobs;
+    int             next;
+    int             finished;
+    int             active;
+};
+
+// called with pool->mutex held, returns with it held
+static void
+pool_work(struct uvc_pool *pool)
+{
+    int job, n = 0;
+    pool->active++;
+    pthread_mutex_unlock(&pool->mutex);
+    while ((job = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->njobs) {
+        pool->fn(pool->ctxt, job);
+        n++;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->finished += n;
+    if (--pool->active == 0 && pool->finished == pool->njobs) pthread_cond_signal(&pool->done);
+}
+
+static void* pool_thread_proc(void *argv)
+{
+    struct uvc_pool *pool = (struct uvc_pool*)argv;
+    unsigned int     gen  = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->gen == gen && !pool->exit) pthread_cond_wait(&pool->cond, &pool->mutex);
+        if (pool->exit) break;
+        gen = pool->gen;
+        pool_work(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+struct uvc_pool* uvc_pool_create(int nthreads)
+{
+    struct uvc_pool *pool;
+    int i;
+
+    if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+    if (nthreads > POOL_MAX_THREADS) nthreads = POOL_MAX_THREADS;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->mutex  , NULL);
+    pthread_mutex_init(&pool->runlock, NULL);
+    pthread_cond_init (&pool->cond   , NULL);
+    pthread_cond_init (&pool->done   , NULL);
+
+    // the caller of uvc_pool_run() is the last worker
+    for (i=0; i<nthreads-1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread_proc, pool) != 0) break;
+    }
+    pool->nthreads = i + 1;
+    return pool;
+}
+
+void uvc_pool_destroy(struct uvc_pool *pool)
+{
+    int i;
+    if (!pool) return;
+    pthread_mutex_lock(&pool->mutex);
+    pool->exit = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i=0; i<pool->nthreads-1; i++) pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->mutex  );
+    pthread_mutex_destroy(&pool->runlock);
+    pthread_cond_destroy (&pool->cond   );
+    pthread_cond_destroy (&pool->done   );
+    free(pool);
+}
+
+int uvc_pool_size(struct uvc_pool *pool)
+{
+    return pool ? pool->nthreads : 1;
+}
+
+void uvc_pool_run(struct uvc_pool *pool, void (*fn)(void *ctxt, int job), void *ctxt, int njobs)
+{
+    int i;
+    if (njobs <= 0) return;
+    if (!pool || pool->nthreads == 1 || njobs == 1) {
+        for (i=0; i<njobs; i++) fn(ctxt, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->runlock);
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn       = fn;
+    pool->ctxt     = ctxt;
+    pool->njobs    = njobs;
+    pool->next     = 0;
+    pool->finished = 0;
+    pool->gen++;
+    pthread_cond_broadcast(&pool->cond);
+    pool_work(pool);
+    while (pool->finished < pool->njobs || pool->active) pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->runlock);
+}
@@ -0,0 +1,14 @@
+#ifndef __UVC_POOL_H__
+#define __UVC_POOL_H__
+
+// fixed set of worker threads for splitting per-frame work across cores
+struct uvc_pool;
+
+struct uvc_pool* uvc_pool_create (int nthreads); // nthreads <= 0: one per online cpu
+void             uvc_pool_destroy(struct uvc_pool *pool);
+int              uvc_pool_size   (struct uvc_pool *pool);
+
+// run fn(ctxt, 0 .. njobs-1) on the workers and the calling thread, returns when all jobs are done
+void uvc_pool_run(struct uvc_pool *pool, void (*fn)(void *ctxt, int job), void *ctxt, int njobs);
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "uvc_source.h"
+
+/* ---------------------------------------------------------------------------
+ * In-process producer queue. Frames are queued by reference up to depth and
+ * read in place, the producer gets each one back through its release
+ * callback. The eventfd is readable exactly while the queue has room.
+ * Producers waiting for room are counted, close wakes them up and waits
+ * until the last one has left before the queue goes away.
+ */
+
+struct push_entry {
+    struct camuvc_frame frame;
+    void (*release)(void *opaque, const struct camuvc_frame *frame);
+    void  *opaque;
+};
+
+struct uvc_push {
+    struct uvc_source  src;
+    pthread_mutex_t    mutex;
+    pthread_cond_t     cond;
+    struct push_entry *queue;
+    int                depth;
+    int                head;
+    int                count;
+    struct push_entry  cur;   // last frame read, goes back on the next read or a full flush
+    int                efd;
+    int                exit;
+    int                users; // producers inside uvc_push_frame()
+};
+
+static void
+push_release(struct push_entry *e)
+{
+    if (e->release) e->release(e->opaque, &e->frame);
+    e->release = NULL;
+}
+
+// keep the eventfd level in step with free room, called with the mutex held
+static void
+push_update_fd(struct uvc_push *pq, int wasfull)
+{
+    uint64_t cnt = 1;
+    int full = pq->count == pq->depth;
+
+    if (wasfull && !full) {
+        if (write(pq->efd, &cnt, sizeof(cnt)) < 0) {}
+    } else if (!wasfull && full) {
+        if (read(pq->efd, &cnt, sizeof(cnt)) < 0) {}
+    }
+}
+
+void uvc_push_flush(struct uvc_source *src, int all)
+{
+    struct uvc_push  *pq = (struct uvc_push*)src;
+    struct push_entry stale[pq->depth + 1];
+    int n, i, wasfull;
+
+    pthread_mutex_lock(&pq->mutex);
+    wasfull = pq->count == pq->depth;
+    for (n=0; pq->count; n++) {
+        stale[n]  = pq->queue[pq->head];
+        pq->head  = (pq->head + 1) % pq->depth;
+        pq->count--;
+    }
+    if (all) {
+        stale[n++] = pq->cur;
+        pq->cur.release = NULL;
+    }
+    push_update_fd(pq, wasfull);
+    pthread_cond_broadcast(&pq->cond);
+    pthread_mutex_unlock(&pq->mutex);
+    for (i=0; i<n; i++) push_release(&stale[i]);
+}
+
+static int
+push_start(struct uvc_source *src, unsigned int fcc, int width, int height)
+{
+    (void)fcc;
+    (void)width;
+    (void)height;
+
+    // frames queued for an earlier stream are not shown to the new one
+    uvc_push_flush(src, 1);
+    return 0;
+}
+
+static int
+push_read(struct uvc_source *src, struct camuvc_frame *frame)
+{
+    struct uvc_push  *pq = (struct uvc_push*)src;
+    struct push_entry last;
+    struct timespec   ts;
+    int wasfull;
+
+    // the previous frame has gone out by now
+    pthread_mutex_lock(&pq->mutex);
+    last = pq->cur;
+    pq->cur.release = NULL;
+    pthread_mutex_unlock(&pq->mutex);
+    push_release(&last);
+
+    pthread_mutex_lock(&pq->mutex);
+    if (!pq->count) {
+        // short timeout so that the capture thread still notices exit
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += 100 * 1000000;
+        if (ts.tv_nsec >= 1000000000) { ts.tv_nsec -= 1000000000; ts.tv_sec++; }
+        while (!pq->count && pthread_cond_timedwait(&pq->cond, &pq->mutex, &ts) == 0);
+    }
+    if (!pq->count) {
+        pthread_mutex_unlock(&pq->mutex);
+        return -1;
+    }
+    wasfull   = pq->count == pq->depth;
+    pq->cur   = pq->queue[pq->head];
+    pq->head  = (pq->head + 1) % pq->depth;
+    pq->count--;
+    push_update_fd(pq, wasfull);
+    pthread_cond_broadcast(&pq->cond);
+    *frame = pq->cur.frame;
+    pthread_mutex_unlock(&pq->mutex);
+    return 0;
+}
+
+static void
+push_close(struct uvc_source *src)
+{
+    struct uvc_push *pq = (struct uvc_push*)src;
+
+    // producers still waiting for room give up, none may be left when the queue goes
+    pthread_mutex_lock(&pq->mutex);
+    pq->exit = 1;
+    pthread_cond_broadcast(&pq->cond);
+    while (pq->users) pthread_cond_wait(&pq->cond, &pq->mutex);
+    pthread_mutex_unlock(&pq->mutex);
+
+    uvc_push_flush(src, 1);
+    if (pq->efd >= 0) close(pq->efd);
+    pthread_cond_destroy (&pq->cond);
+    pthread_mutex_destroy(&pq->mutex);
+    free(pq->queue);
+    free(pq);
+}
+
+struct uvc_source* uvc_push_open(int depth)
+{
+    pthread_condattr_t attr;
+    struct uvc_push   *pq;
+
+    if (depth <= 0 || depth > 64) return NULL;
+    pq = calloc(1, sizeof(*pq));
+    if (!pq) return NULL;
+    pq->depth = depth;
+    pq->queue = calloc(depth, sizeof(struct push_entry));
+    pq->efd   = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+    pthread_mutex_init(&pq->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pq->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (!pq->queue || pq->efd < 0) {
+        push_close(&pq->src);
+        return NULL;
+    }
+    pq->src.paced = 0;
+    pq->src.start = push_start;
+    pq->src.read  = push_read;
+    pq->src.close = push_close;
+    return &pq->src;
+}
+
+int uvc_push_frame(struct uvc_source *src, const struct camuvc_frame *frame,
+                   void (*release)(void *opaque, const struct camuvc_frame *frame), void *opaque, int timeout)
+{
+    struct uvc_push   *pq = (struct uvc_push*)src;
+    struct push_entry *e;
+    struct timespec    ts;
+    int ret = 0;
+
+    pthread_mutex_lock(&pq->mutex);
+    pq->users++;
+    if (pq->count == pq->depth && timeout != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec  += timeout / 1000;
+        ts.tv_nsec += timeout % 1000 * 1000000;
+        if (ts.tv_nsec >= 1000000000) { ts.tv_nsec -= 1000000000; ts.tv_sec++; }
+        while (pq->count == pq->depth && !pq->exit && ret == 0) {
+            ret = timeout < 0 ? pthread_cond_wait(&pq->cond, &pq->mutex) : pthread_cond_timedwait(&pq->cond, &pq->mutex, &ts);
+        }
+    }
+    if (pq->count == pq->depth || pq->exit) {
+        errno = pq->exit ? EPIPE : EAGAIN;
+        pq->users--;
+        pthread_cond_broadcast(&pq->cond);
+        pthread_mutex_unlock(&pq->mutex);
+        return -1;
+    }
+    e = &pq->queue[(pq->head + pq->count) % pq->depth];
+    e->frame   = *frame;
+    e->release = release;
+    e->opaque  = opaque;
+    pq->count++;
+    pq->users--;
+    push_update_fd(pq, 0);
+    pthread_cond_broadcast(&pq->cond);
+    pthread_mutex_unlock(&pq->mutex);
+    return 0;
+}
+
+int uvc_push_fd(struct uvc_source *src)
+{
+    return ((struct uvc_push*)src)->efd;
+}
+
+int uvc_push_queued(struct uvc_source *src, int *depth)
+{
+    struct uvc_push *pq = (struct uvc_push*)src;
+    int count;
+
+    pthread_mutex_lock(&pq->mutex);
+    count = pq->count;
+    pthread_mutex_unlock(&pq->mutex);
+    if (depth) *depth = pq->depth;
+    return count;
+}
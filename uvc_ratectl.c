@@ -0,0 +1,69 @@
+#include <string.h>
+#include "uvc_ratectl.h"
+
+#define RATECTL_WINDOW_NS (500 * 1000 * 1000LL)
+
+void uvc_ratectl_reset(struct uvc_ratectl *rc, int minbps, int maxbps, int bitrate, int interval)
+{
+    memset(rc, 0, sizeof(*rc));
+    rc->minbps   = minbps;
+    rc->maxbps   = maxbps;
+    rc->target   = bitrate < minbps ? minbps : bitrate > maxbps ? maxbps : bitrate;
+    rc->interval = (int64_t)interval * 100;
+}
+
+void uvc_ratectl_queued(struct uvc_ratectl *rc, unsigned int index, int bytes, int64_t now)
+{
+    if (index >= RATECTL_MAX_BUFS) return;
+    rc->qtime [index] = now;
+    rc->qbytes[index] = bytes;
+    rc->inflight++;
+}
+
+int uvc_ratectl_done(struct uvc_ratectl *rc, unsigned int index, int64_t now)
+{
+    int64_t span, target;
+
+    if (index >= RATECTL_MAX_BUFS || !rc->qtime[index] || !rc->maxbps) return 0;
+    rc->woccupancy += rc->inflight--;
+    rc->wdelay     += now - rc->qtime[index];
+    rc->wbytes     += rc->qbytes[index];
+    rc->wframes    ++;
+    rc->qtime[index] = 0;
+
+    if (!rc->wstart) rc->wstart = now;
+    span = now - rc->wstart;
+    if (span < RATECTL_WINDOW_NS || rc->wframes < 4) return 0;
+
+    rc->drainbps = rc->wbytes * 8 * 1000000000LL / span;
+    rc->delayus  = rc->wdelay / rc->wframes / 1000;
+    target       = rc->target;
+
+    // buffers waiting more than two frame times or a full queue means the host is not keeping
+    // up, back off below what it actually drained, otherwise probe upwards slowly
+    if (rc->wdelay / rc->wframes > 2 * rc->interval || rc->woccupancy / rc->wframes > 2) {
+        target    = target * 85 / 100;
+        if (target > rc->drainbps * 9LL / 10) target = rc->drainbps * 9LL / 10;
+        rc->calm  = 0;
+    } else if (rc->wdelay / rc->wframes < rc->interval) {
+        // the step is 5% of the configured range rather than of the current target, so
+        // the probe climbs at the same pace from any level, two calm windows per step
+        if (++rc->calm >= 2) {
+            target  += (rc->maxbps - rc->minbps) / 20 + 1;
+            rc->calm = 0;
+        }
+    } else {
+        rc->calm = 0;
+    }
+    if (target < rc->minbps) target = rc->minbps;
+    if (target > rc->maxbps) target = rc->maxbps;
+
+    rc->wstart     = now;
+    rc->wbytes     = 0;
+    rc->wdelay     = 0;
+    rc->wframes    = 0;
+    rc->woccupancy = 0;
+    if (target == rc->target) return 0;
+    rc->target = target;
+    return target;
+}
@@ -0,0 +1,35 @@
+#ifndef __UVC_RATECTL_H__
+#define __UVC_RATECTL_H__
+
+#include <stdint.h>
+
+#define RATECTL_MAX_BUFS 32
+
+// closed-loop bitrate target from gadget buffer round trips, a buffer is
+// "queued" at QBUF and "done" at DQBUF, the time in between is how long
+// the host took to drain it
+struct uvc_ratectl {
+    int      minbps;
+    int      maxbps;
+    int      target;
+    int64_t  interval;   // ns per frame
+    int64_t  qtime[RATECTL_MAX_BUFS];
+    int      qbytes[RATECTL_MAX_BUFS];
+    int      inflight;
+
+    int64_t  wstart;     // current measurement window
+    int64_t  wbytes;
+    int64_t  wdelay;
+    int      wframes;
+    int      woccupancy;
+    int      calm;       // consecutive uncongested windows
+
+    int      drainbps;   // last measured values, for reporting
+    int      delayus;
+};
+
+void uvc_ratectl_reset (struct uvc_ratectl *rc, int minbps, int maxbps, int bitrate, int interval);
+void uvc_ratectl_queued(struct uvc_ratectl *rc, unsigned int index, int bytes, int64_t now);
+int  uvc_ratectl_done  (struct uvc_ratectl *rc, unsigned int index, int64_t now); // new target or 0 if unchanged
+
+#endif
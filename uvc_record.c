@@ -0,0 +1,460 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/videodev2.h>
+#include <linux/io_uring.h>
+#include "uvc_gather.h"
+#include "uvc_record.h"
+
+/* ---------------------------------------------------------------------------
+ * Recording tee. The streaming side only copies the frame into the ring and
+ * bumps an eventfd, everything that may block (open, write, close) happens
+ * on the writer thread. Writes go through an io_uring set up with the raw
+ * syscalls, up to REC_MAX_FRAMES of them in flight, and the ring registers
+ * the same eventfd so one read wakes the writer for new frames as well as
+ * for completions.
+ */
+
+#define REC_MAX_FRAMES 64
+#define REC_MAX_SEGS   4
+
+struct rec_frame {
+    int      off;
+    int      len;
+    int      wrote;
+    int      seg;    // slot in segs[], -1 until submitted
+    int64_t  foff;
+    int      newseg; // starts the next segment file
+    int      done;
+    struct iovec iov;
+};
+
+struct rec_seg {
+    int fd;
+    int inflight;
+};
+
+struct uvc_record {
+    pthread_t        thread;
+    pthread_mutex_t  mutex;
+    int              exit;
+    int              efd;
+
+    // producer side, under the mutex
+    uint8_t         *buf;
+    int              size;
+    struct rec_frame frames[REC_MAX_FRAMES];
+    int              first;   // oldest frame still in the ring
+    int              count;
+    int              nsub;    // frames the writer has taken
+    struct uvc_gather gather;
+    unsigned int     fcc;
+    int              needkey;
+    int              started;
+    int64_t          segwritten;
+    int64_t          segbytes;
+    int              dropped;
+    int              failed;
+
+    // writer side
+    char             path[256];
+    int              segno;
+    struct rec_seg   segs[REC_MAX_SEGS];
+    int              cur;     // slot being written, -1: none open
+    int64_t          fpos;
+    int              inflight;
+
+    int              ring;    // io_uring fd, -1: pwrite
+    void            *sqmem;
+    void            *cqmem;
+    size_t           sqsize;
+    size_t           cqsize;
+    struct io_uring_sqe *sqes;
+    size_t           sqessize;
+    unsigned        *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned        *cqhead, *cqtail, *cqmask;
+    struct io_uring_cqe *cqes;
+};
+
+static int
+rec_uring_setup(struct uvc_record *rec)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    rec->ring = syscall(__NR_io_uring_setup, REC_MAX_FRAMES, &p);
+    if (rec->ring < 0) return -1;
+
+    rec->sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    rec->cqsize = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (rec->cqsize > rec->sqsize) rec->sqsize = rec->cqsize;
+        rec->cqsize = 0;
+    }
+    rec->sqmem = mmap(NULL, rec->sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rec->ring, IORING_OFF_SQ_RING);
+    if (rec->sqmem == MAP_FAILED) { rec->sqmem = NULL; return -1; }
+    rec->cqmem = rec->sqmem;
+    if (rec->cqsize) {
+        rec->cqmem = mmap(NULL, rec->cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rec->ring, IORING_OFF_CQ_RING);
+        if (rec->cqmem == MAP_FAILED) { rec->cqmem = NULL; return -1; }
+    }
+    rec->sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+    rec->sqes = mmap(NULL, rec->sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rec->ring, IORING_OFF_SQES);
+    if (rec->sqes == MAP_FAILED) { rec->sqes = NULL; return -1; }
+
+    rec->sqhead  = (unsigned*)((uint8_t*)rec->sqmem + p.sq_off.head);
+    rec->sqtail  = (unsigned*)((uint8_t*)rec->sqmem + p.sq_off.tail);
+    rec->sqmask  = (unsigned*)((uint8_t*)rec->sqmem + p.sq_off.ring_mask);
+    rec->sqarray = (unsigned*)((uint8_t*)rec->sqmem + p.sq_off.array);
+    rec->cqhead  = (unsigned*)((uint8_t*)rec->cqmem + p.cq_off.head);
+    rec->cqtail  = (unsigned*)((uint8_t*)rec->cqmem + p.cq_off.tail);
+    rec->cqmask  = (unsigned*)((uint8_t*)rec->cqmem + p.cq_off.ring_mask);
+    rec->cqes    = (struct io_uring_cqe*)((uint8_t*)rec->cqmem + p.cq_off.cqes);
+    return syscall(__NR_io_uring_register, rec->ring, IORING_REGISTER_EVENTFD, &rec->efd, 1) < 0 ? -1 : 0;
+}
+
+static void
+rec_uring_free(struct uvc_record *rec)
+{
+    if (rec->sqes ) munmap(rec->sqes , rec->sqessize);
+    if (rec->cqmem && rec->cqmem != rec->sqmem) munmap(rec->cqmem, rec->cqsize);
+    if (rec->sqmem) munmap(rec->sqmem, rec->sqsize);
+    if (rec->ring >= 0) close(rec->ring);
+    rec->sqes  = NULL;
+    rec->sqmem = rec->cqmem = NULL;
+    rec->ring  = -1;
+}
+
+static void
+rec_seg_release(struct uvc_record *rec, int slot)
+{
+    struct rec_seg *s = &rec->segs[slot];
+    if (s->fd >= 0 && !s->inflight && slot != rec->cur) {
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+// frame i is on disk or given up on, called on the writer thread
+static void
+rec_frame_done(struct uvc_record *rec, struct rec_frame *f)
+{
+    pthread_mutex_lock(&rec->mutex);
+    f->done = 1;
+    while (rec->count && rec->frames[rec->first].done) {
+        rec->first = (rec->first + 1) % REC_MAX_FRAMES;
+        rec->count--;
+        rec->nsub--;
+    }
+    pthread_mutex_unlock(&rec->mutex);
+}
+
+static void
+rec_uring_submit(struct uvc_record *rec, struct rec_frame *f)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *rec->sqtail, idx = tail & *rec->sqmask;
+
+    sqe = &rec->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    // writev rather than write, it goes back to 5.1 kernels
+    f->iov.iov_base = rec->buf + f->off + f->wrote;
+    f->iov.iov_len  = f->len - f->wrote;
+    sqe->opcode    = IORING_OP_WRITEV;
+    sqe->fd        = rec->segs[f->seg].fd;
+    sqe->addr      = (uintptr_t)&f->iov;
+    sqe->len       = 1;
+    sqe->off       = f->foff + f->wrote;
+    sqe->user_data = (uintptr_t)f;
+    rec->sqarray[idx] = idx;
+    __atomic_store_n(rec->sqtail, tail + 1, __ATOMIC_RELEASE);
+    rec->segs[f->seg].inflight++;
+    rec->inflight++;
+}
+
+// reap completions, with wait at least one, returns how many
+static int
+rec_uring_reap(struct uvc_record *rec, int wait)
+{
+    struct io_uring_cqe *cqe;
+    struct rec_frame    *f;
+    unsigned head, resubmit = 0;
+    int n = 0;
+
+    if (wait && syscall(__NR_io_uring_enter, rec->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) return -1;
+    head = *rec->cqhead;
+    while (head != __atomic_load_n(rec->cqtail, __ATOMIC_ACQUIRE)) {
+        cqe = &rec->cqes[head & *rec->cqmask];
+        f   = (struct rec_frame*)(uintptr_t)cqe->user_data;
+        rec->segs[f->seg].inflight--;
+        rec->inflight--;
+        if (cqe->res < 0 || (cqe->res == 0 && f->wrote < f->len)) {
+            if (!rec->failed) printf("record: write failed: %s (%d)\n", strerror(-cqe->res), -cqe->res);
+            rec->failed = 1;
+            f->wrote = f->len;
+        } else {
+            f->wrote += cqe->res;
+        }
+        if (f->wrote < f->len) {
+            rec_uring_submit(rec, f); // short write, the rest goes again
+            resubmit++;
+        } else {
+            rec_seg_release(rec, f->seg);
+            rec_frame_done(rec, f);
+        }
+        head++;
+        n++;
+    }
+    __atomic_store_n(rec->cqhead, head, __ATOMIC_RELEASE);
+    if (resubmit) syscall(__NR_io_uring_enter, rec->ring, resubmit, 0, 0, NULL, 0);
+    return n;
+}
+
+// start the next segment file, called on the writer thread
+static int
+rec_rotate(struct uvc_record *rec)
+{
+    char name[300];
+    int  slot, prev = rec->cur;
+
+    for (;;) {
+        for (slot=0; slot<REC_MAX_SEGS && rec->segs[slot].fd >= 0; slot++);
+        if (slot < REC_MAX_SEGS || rec->ring < 0) break;
+        // every slot still has writes in flight
+        if (rec_uring_reap(rec, 1) < 0) return -1;
+    }
+    if (slot == REC_MAX_SEGS) return -1;
+
+    snprintf(name, sizeof(name), rec->path, rec->segno++);
+    rec->segs[slot].fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (rec->segs[slot].fd < 0) {
+        printf("record: unable to open %s: %s (%d)\n", name, strerror(errno), errno);
+        return -1;
+    }
+    printf("record: writing %s\n", name);
+    rec->cur  = slot;
+    rec->fpos = 0;
+    if (prev >= 0) rec_seg_release(rec, prev);
+    return 0;
+}
+
+static void* rec_thread_proc(void *argv)
+{
+    struct uvc_record *rec = (struct uvc_record*)argv;
+    struct rec_frame  *f;
+    uint64_t cnt;
+    int      i, n, nsub, exiting, failed;
+    ssize_t  ret;
+
+    while (1) {
+        if (read(rec->efd, &cnt, sizeof(cnt)) < 0 && errno != EINTR && errno != EAGAIN) break;
+        if (rec->ring >= 0) rec_uring_reap(rec, 0);
+
+        pthread_mutex_lock(&rec->mutex);
+        i       = (rec->first + rec->nsub) % REC_MAX_FRAMES;
+        n       = rec->count - rec->nsub;
+        exiting = rec->exit;
+        failed  = rec->failed;
+        rec->nsub += n;
+        pthread_mutex_unlock(&rec->mutex);
+
+        for (nsub=0; n>0; n--, i=(i+1)%REC_MAX_FRAMES) {
+            f = &rec->frames[i];
+            if (failed || ((f->newseg || rec->cur < 0) && rec_rotate(rec) < 0)) {
+                failed = rec->failed = 1;
+                rec_frame_done(rec, f);
+                continue;
+            }
+            f->seg  = rec->cur;
+            f->foff = rec->fpos;
+            rec->fpos += f->len;
+            if (rec->ring >= 0) {
+                rec_uring_submit(rec, f);
+                nsub++;
+                continue;
+            }
+            // no io_uring, the plain write blocks this thread only
+            while (f->wrote < f->len && (ret = pwrite(rec->segs[f->seg].fd, rec->buf + f->off + f->wrote, f->len - f->wrote, f->foff + f->wrote)) != 0) {
+                if (ret < 0 && errno == EINTR) continue;
+                if (ret < 0) {
+                    printf("record: write failed: %s (%d)\n", strerror(errno), errno);
+                    rec->failed = 1;
+                    break;
+                }
+                f->wrote += ret;
+            }
+            rec_frame_done(rec, f);
+        }
+        if (nsub && syscall(__NR_io_uring_enter, rec->ring, nsub, 0, 0, NULL, 0) < 0) {
+            printf("record: io_uring_enter failed: %s (%d)\n", strerror(errno), errno);
+        }
+
+        // on exit everything queued before it is written out first
+        if (exiting) {
+            while (rec->ring >= 0 && rec->inflight && rec_uring_reap(rec, 1) >= 0);
+            break;
+        }
+    }
+    return NULL;
+}
+
+// the path goes to snprintf as the format, it has to hold exactly one %d (a width
+// like %03d is fine) and nothing else but %%, or every segment would hit one file
+static int
+rec_path_ok(const char *path)
+{
+    int n = 0;
+
+    while ((path = strchr(path, '%'))) {
+        if (*++path == '%') { path++; continue; }
+        while (*path >= '0' && *path <= '9') path++;
+        if (*path++ != 'd' || ++n > 1) return 0;
+    }
+    return n == 1;
+}
+
+struct uvc_record* uvc_record_open(const char *path, int64_t segbytes, int bufsize)
+{
+    struct uvc_record *rec;
+    int i;
+
+    if (!path || strlen(path) >= sizeof(rec->path)) return NULL;
+    if (!rec_path_ok(path)) {
+        printf("record: %s needs exactly one %%d for the segment number !\n", path);
+        return NULL;
+    }
+    rec = calloc(1, sizeof(*rec));
+    if (!rec) return NULL;
+    strcpy(rec->path, path);
+    rec->segbytes = segbytes;
+    rec->size     = bufsize > 0 ? bufsize : 8 * 1024 * 1024;
+    rec->buf      = malloc(rec->size);
+    rec->efd      = eventfd(0, EFD_CLOEXEC);
+    rec->cur      = -1;
+    rec->ring     = -1;
+    for (i=0; i<REC_MAX_SEGS; i++) rec->segs[i].fd = -1;
+    pthread_mutex_init(&rec->mutex, NULL);
+    if (!rec->buf || rec->efd < 0) goto failed;
+
+    if (rec_uring_setup(rec) < 0) {
+        printf("record: io_uring not available, falling back to pwrite\n");
+        rec_uring_free(rec);
+    }
+    if (pthread_create(&rec->thread, NULL, rec_thread_proc, rec) != 0) goto failed;
+    return rec;
+
+failed:
+    rec_uring_free(rec);
+    if (rec->efd >= 0) close(rec->efd);
+    pthread_mutex_destroy(&rec->mutex);
+    free(rec->buf);
+    free(rec);
+    return NULL;
+}
+
+int uvc_record_close(struct uvc_record *rec)
+{
+    uint64_t cnt = 1;
+    int dropped, i;
+
+    if (!rec) return 0;
+    pthread_mutex_lock(&rec->mutex);
+    rec->exit = 1;
+    pthread_mutex_unlock(&rec->mutex);
+    if (write(rec->efd, &cnt, sizeof(cnt)) < 0) {}
+    pthread_join(rec->thread, NULL);
+
+    rec->cur = -1;
+    for (i=0; i<REC_MAX_SEGS; i++) {
+        if (rec->segs[i].fd >= 0) close(rec->segs[i].fd);
+    }
+    rec_uring_free(rec);
+    close(rec->efd);
+    pthread_mutex_destroy(&rec->mutex);
+    dropped = rec->dropped;
+    free(rec->buf);
+    free(rec);
+    return dropped;
+}
+
+// offset in the ring where need contiguous bytes fit, -1 if they do not, called with the mutex held
+static int
+rec_alloc(struct uvc_record *rec, int need)
+{
+    struct rec_frame *first, *last;
+    int head, tail;
+
+    if (rec->count == REC_MAX_FRAMES) return -1;
+    if (!rec->count) return need <= rec->size ? 0 : -1;
+    first = &rec->frames[rec->first];
+    last  = &rec->frames[(rec->first + rec->count - 1) % REC_MAX_FRAMES];
+    head  = last->off + last->len;
+    tail  = first->off;
+    if (head > tail) {
+        if (rec->size - head >= need) return head;
+        return tail > need ? 0 : -1;
+    }
+    return tail - head > need ? head : -1;
+}
+
+int uvc_record_frame(struct uvc_record *rec, unsigned int fcc, const uint8_t *data, int len)
+{
+    struct iovec      iov = { (void*)data, len };
+    struct rec_frame *f;
+    uint64_t cnt = 1;
+    int off, n, need;
+
+    pthread_mutex_lock(&rec->mutex);
+    if (rec->failed || rec->exit) {
+        pthread_mutex_unlock(&rec->mutex);
+        return -1;
+    }
+    // a new format starts a new file, and the file starts with a key frame
+    if (!rec->started || rec->fcc != fcc) {
+        uvc_gather_reset(&rec->gather, fcc);
+        rec->fcc           = fcc;
+        rec->gather.repeat = 1;
+        rec->needkey       = 1;
+        rec->segwritten    = -1;
+        rec->started       = 1;
+    }
+
+    // room for parameter sets put in front of key frames that come without them
+    need = len + (rec->gather.codec ? 3 * GATHER_MAX_PSET : 0);
+    if ((off = rec_alloc(rec, need)) < 0) {
+        rec->dropped++;
+        rec->needkey = 1;
+        pthread_mutex_unlock(&rec->mutex);
+        return -1;
+    }
+    n = uvc_gather_frame(&rec->gather, rec->buf + off, need, &iov, 1);
+    if (rec->needkey && !rec->gather.irap) {
+        rec->dropped++;
+        pthread_mutex_unlock(&rec->mutex);
+        return -1;
+    }
+
+    f = &rec->frames[(rec->first + rec->count) % REC_MAX_FRAMES];
+    memset(f, 0, sizeof(*f));
+    f->off    = off;
+    f->len    = n;
+    f->seg    = -1;
+    f->newseg = rec->segwritten < 0 || (rec->segbytes && rec->segwritten >= rec->segbytes && rec->gather.irap);
+    if (f->newseg) rec->segwritten = 0;
+    rec->segwritten += n;
+    rec->needkey = 0;
+    rec->count++;
+    pthread_mutex_unlock(&rec->mutex);
+
+    if (write(rec->efd, &cnt, sizeof(cnt)) < 0) {}
+    return 0;
+}
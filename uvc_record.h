@@ -0,0 +1,18 @@
+#ifndef __UVC_RECORD_H__
+#define __UVC_RECORD_H__
+
+#include <stdint.h>
+
+// tee of the encoded stream into segment files, frames are copied into a bounded ring
+// and written from there by a thread of its own through io_uring, or pwrite where
+// io_uring is not available, a full ring drops frames up to the next key frame
+struct uvc_record;
+
+// path is a printf pattern with exactly one %d for the segment number and no other
+// conversion but %%, segments end at the first key frame after segbytes (0: one file),
+// bufsize 0 means 8 MB
+struct uvc_record* uvc_record_open (const char *path, int64_t segbytes, int bufsize);
+int                uvc_record_close(struct uvc_record *rec); // writes out what is queued, returns frames dropped
+int                uvc_record_frame(struct uvc_record *rec, unsigned int fcc, const uint8_t *data, int len);
+
+#endif
@@ -0,0 +1,378 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include "uvc_source.h"
+
+/* ---------------------------------------------------------------------------
+ * Elementary stream replay: the file is mapped once, frame boundaries are
+ * indexed up front and frames are handed out as pointers into the mapping.
+ */
+
+struct replay_index {
+    uint32_t off;
+    uint32_t len;
+};
+
+struct uvc_replay {
+    struct uvc_source    src;
+    unsigned int         fcc;
+    int                  width;  // from the first SOF or SPS, 0 if it could not be read
+    int                  height;
+    uint8_t             *base;
+    size_t               size;
+    struct replay_index *index;
+    int                  nframes;
+    int                  maxframes;
+    int                  cur;
+};
+
+static int
+replay_add_frame(struct uvc_replay *rp, size_t start, size_t end)
+{
+    struct replay_index *index;
+    if (end <= start) return 0;
+    if (rp->nframes == rp->maxframes) {
+        rp->maxframes = rp->maxframes ? rp->maxframes * 2 : 256;
+        index = realloc(rp->index, rp->maxframes * sizeof(*index));
+        if (index == NULL) return -1;
+        rp->index = index;
+    }
+    rp->index[rp->nframes].off = start;
+    rp->index[rp->nframes].len = end - start;
+    rp->nframes++;
+    return 0;
+}
+
+// returns offset of the next start code (00 00 01 or 00 00 00 01) at or after pos
+static size_t
+replay_next_startcode(const uint8_t *p, size_t pos, size_t size)
+{
+    for (; pos + 3 <= size; pos++) {
+        if (p[pos + 2] > 1) { pos += 2; continue; }
+        if (p[pos] == 0 && p[pos + 1] == 0 && p[pos + 2] == 1) {
+            return (pos > 0 && p[pos - 1] == 0) ? pos - 1 : pos;
+        }
+    }
+    return size;
+}
+
+static int
+replay_nal_is_prefix(unsigned int fcc, int type)
+{
+    if (fcc == v4l2_fourcc('H','2','6','4')) {
+        return (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+    } else {
+        return (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+    }
+}
+
+static int
+replay_index_annexb(struct uvc_replay *rp)
+{
+    const uint8_t *p = rp->base;
+    size_t pos, hdr, start = 0;
+    int    vcl = 0, type, first;
+
+    pos = replay_next_startcode(p, 0, rp->size);
+    while (pos < rp->size) {
+        hdr = pos + (p[pos + 2] == 1 ? 3 : 4);
+        if (hdr + 2 >= rp->size) break;
+        if (rp->fcc == v4l2_fourcc('H','2','6','4')) {
+            type  = p[hdr] & 0x1f;
+            first = (type == 1 || type == 5) ? (p[hdr + 1] & 0x80) : 0;
+            type  = (type >= 1 && type <= 5) ? -1 : type;
+        } else {
+            type  = (p[hdr] >> 1) & 0x3f;
+            first = type < 32 ? (p[hdr + 2] & 0x80) : 0;
+            type  = type < 32 ? -1 : type;
+        }
+
+        if (type == -1) {
+            if (first && vcl) {
+                if (replay_add_frame(rp, start, pos) < 0) return -1;
+                start = pos;
+            }
+            vcl = 1;
+        } else if (vcl && replay_nal_is_prefix(rp->fcc, type)) {
+            if (replay_add_frame(rp, start, pos) < 0) return -1;
+            start = pos;
+            vcl   = 0;
+        }
+        pos = replay_next_startcode(p, hdr, rp->size);
+    }
+    return replay_add_frame(rp, start, rp->size);
+}
+
+static int
+replay_index_mjpeg(struct uvc_replay *rp)
+{
+    const uint8_t *p = rp->base;
+    size_t pos = 0, start, len;
+    uint8_t marker;
+
+    while (pos + 4 <= rp->size) {
+        if (p[pos] != 0xff || p[pos + 1] != 0xd8) { pos++; continue; }
+        start = pos;
+        pos  += 2;
+        while (pos + 2 <= rp->size) {
+            if (p[pos] != 0xff) break; // corrupt, resync on next SOI
+            marker = p[pos + 1];
+            if (marker == 0xff) { pos++; continue; }
+            pos += 2;
+            if (marker == 0xd9) {
+                if (replay_add_frame(rp, start, pos) < 0) return -1;
+                break;
+            }
+            if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) continue;
+            if (pos + 2 > rp->size) break;
+            len  = (p[pos] << 8) | p[pos + 1];
+            pos += len;
+            if (marker == 0xda) { // skip entropy coded data up to the next real marker
+                while (pos + 1 < rp->size && !(p[pos] == 0xff && p[pos + 1] != 0x00 && (p[pos + 1] < 0xd0 || p[pos + 1] > 0xd7))) pos++;
+            }
+        }
+    }
+    return 0;
+}
+
+static unsigned int
+replay_probe(const uint8_t *p, size_t size)
+{
+    size_t pos;
+    if (size >= 2 && p[0] == 0xff && p[1] == 0xd8) return V4L2_PIX_FMT_MJPEG;
+    pos = replay_next_startcode(p, 0, size);
+    if (pos >= size) return 0;
+    pos += p[pos + 2] == 1 ? 3 : 4;
+    if (pos + 2 > size) return 0;
+    // hevc nal header: forbidden_zero_bit, 6-bit type, 6-bit layer id, non-zero 3-bit temporal id
+    if ((p[pos] & 0x81) == 0 && (p[pos + 1] & 0x07) != 0) {
+        switch ((p[pos] >> 1) & 0x3f) {
+        case 32: case 33: case 34: case 35: case 39:
+            return v4l2_fourcc('H','2','6','5');
+        }
+    }
+    return v4l2_fourcc('H','2','6','4');
+}
+
+// picture size from the SOF segment of the first frame
+static void
+replay_size_mjpeg(struct uvc_replay *rp)
+{
+    const uint8_t *p = rp->base + rp->index[0].off;
+    size_t pos = 2, end = rp->index[0].len;
+    uint8_t marker;
+
+    while (pos + 9 <= end && p[pos] == 0xff) {
+        marker = p[pos + 1];
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            rp->height = (p[pos + 5] << 8) | p[pos + 6];
+            rp->width  = (p[pos + 7] << 8) | p[pos + 8];
+            return;
+        }
+        if (marker == 0xda) return;
+        pos += 2 + ((p[pos + 2] << 8) | p[pos + 3]);
+    }
+}
+
+struct replay_bits {
+    uint8_t buf[256]; // rbsp, emulation prevention bytes removed
+    int     len;
+    int     pos;      // in bits
+};
+
+static unsigned int
+replay_u(struct replay_bits *b, int n)
+{
+    unsigned int v = 0;
+    for (; n > 0; n--, b->pos++) {
+        v = v << 1 | (b->pos < b->len * 8 ? (b->buf[b->pos >> 3] >> (7 - (b->pos & 7))) & 1 : 0);
+    }
+    return v;
+}
+
+static unsigned int
+replay_ue(struct replay_bits *b)
+{
+    int zeros = 0;
+    while (zeros < 31 && b->pos < b->len * 8 && !replay_u(b, 1)) zeros++;
+    return (1U << zeros) - 1 + replay_u(b, zeros);
+}
+
+static int
+replay_se(struct replay_bits *b)
+{
+    unsigned int v = replay_ue(b);
+    return v & 1 ? (int)((v + 1) / 2) : -(int)(v / 2);
+}
+
+// picture size from the first H.264 sequence parameter set, cropping applied
+static void
+replay_size_h264(struct uvc_replay *rp)
+{
+    const uint8_t *p = rp->base;
+    struct replay_bits b;
+    unsigned int profile, chroma = 1, mbs_only, w, h, crop[4] = { 0 }, i, j, n;
+    int    last, next, cx, cy;
+    size_t pos, hdr;
+
+    for (pos=replay_next_startcode(p, 0, rp->size); pos < rp->size; pos=replay_next_startcode(p, hdr, rp->size)) {
+        hdr = pos + (p[pos + 2] == 1 ? 3 : 4);
+        if (hdr < rp->size && (p[hdr] & 0x1f) == 7) break;
+    }
+    if (pos >= rp->size) return;
+    memset(&b, 0, sizeof(b));
+    for (pos=hdr+1; pos<rp->size && b.len<(int)sizeof(b.buf); pos++) {
+        if (pos >= hdr + 3 && p[pos] == 3 && !p[pos - 1] && !p[pos - 2]) continue;
+        if (pos + 2 < rp->size && !p[pos] && !p[pos + 1] && p[pos + 2] <= 1) break;
+        b.buf[b.len++] = p[pos];
+    }
+
+    profile = replay_u(&b, 8);
+    replay_u(&b, 16);
+    replay_ue(&b);
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83 ||
+        profile == 86  || profile == 118 || profile == 128 || profile == 138 || profile == 139 || profile == 134 || profile == 135) {
+        if ((chroma = replay_ue(&b)) == 3) replay_u(&b, 1);
+        replay_ue(&b);
+        replay_ue(&b);
+        replay_u(&b, 1);
+        if (replay_u(&b, 1)) {
+            for (i=0; i<(chroma == 3 ? 12U : 8U); i++) {
+                if (!replay_u(&b, 1)) continue;
+                for (j=0, last=next=8; j<(i < 6 ? 16U : 64U); j++) {
+                    if (next) next = (last + replay_se(&b) + 256) % 256;
+                    last = next ? next : last;
+                }
+            }
+        }
+    }
+    replay_ue(&b);
+    switch (replay_ue(&b)) {
+    case 0:
+        replay_ue(&b);
+        break;
+    case 1:
+        replay_u(&b, 1);
+        replay_se(&b);
+        replay_se(&b);
+        for (i=0, n=replay_ue(&b); i<n && b.pos<b.len*8; i++) replay_se(&b);
+        break;
+    }
+    replay_ue(&b);
+    replay_u(&b, 1);
+    w = replay_ue(&b) + 1;
+    h = replay_ue(&b) + 1;
+    mbs_only = replay_u(&b, 1);
+    if (!mbs_only) replay_u(&b, 1);
+    replay_u(&b, 1);
+    if (replay_u(&b, 1)) {
+        for (i=0; i<4; i++) crop[i] = replay_ue(&b);
+    }
+    if (b.pos > b.len * 8) return; // ran out, the sps was cut short
+
+    cx = chroma == 0 || chroma == 3 ? 1 : 2;
+    cy = (chroma == 0 || chroma > 1 ? 1 : 2) * (2 - mbs_only);
+    rp->width  = w * 16 - cx * (crop[0] + crop[1]);
+    rp->height = (2 - mbs_only) * h * 16 - cy * (crop[2] + crop[3]);
+    if (rp->width <= 0 || rp->height <= 0) rp->width = rp->height = 0;
+}
+
+static int
+replay_start(struct uvc_source *src, unsigned int fcc, int width, int height)
+{
+    struct uvc_replay *rp = (struct uvc_replay*)src;
+    if (fcc != rp->fcc) {
+        printf("replay: file holds %.4s but host committed %.4s !\n", (char*)&rp->fcc, (char*)&fcc);
+        return -1;
+    }
+    if (rp->width && (width != rp->width || height != rp->height)) {
+        printf("replay: file holds %dx%d but host committed %dx%d !\n", rp->width, rp->height, width, height);
+        return -1;
+    }
+    if (!rp->width) printf("replay: frame size of the file is not known, streamed as %dx%d\n", width, height);
+    return 0;
+}
+
+static int
+replay_read(struct uvc_source *src, struct camuvc_frame *frame)
+{
+    struct uvc_replay *rp = (struct uvc_replay*)src;
+    struct replay_index *idx = &rp->index[rp->cur];
+    memset(frame, 0, sizeof(*frame));
+    frame->data = rp->base + idx->off;
+    frame->len  = idx->len;
+    frame->fcc  = rp->fcc;
+    if (++rp->cur == rp->nframes) rp->cur = 0;
+    return 0;
+}
+
+static void
+replay_close(struct uvc_source *src)
+{
+    struct uvc_replay *rp = (struct uvc_replay*)src;
+    if (rp->base) munmap(rp->base, rp->size);
+    free(rp->index);
+    free(rp);
+}
+
+struct uvc_source* uvc_replay_open(const char *file, int fast)
+{
+    struct uvc_replay *rp;
+    struct stat st;
+    int    fd, ret;
+
+    fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        printf("replay: open %s failed: %s (%d)\n", file, strerror(errno), errno);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < 4 || st.st_size > UINT32_MAX) {
+        printf("replay: %s has unusable size !\n", file);
+        close(fd);
+        return NULL;
+    }
+
+    rp = calloc(1, sizeof(*rp));
+    if (rp == NULL) {
+        close(fd);
+        return NULL;
+    }
+    rp->size = st.st_size;
+    rp->base = mmap(NULL, rp->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rp->base == MAP_FAILED) {
+        printf("replay: mmap %s failed: %s (%d)\n", file, strerror(errno), errno);
+        rp->base = NULL;
+        replay_close(&rp->src);
+        return NULL;
+    }
+    madvise(rp->base, rp->size, MADV_WILLNEED);
+
+    rp->fcc = replay_probe(rp->base, rp->size);
+    switch (rp->fcc) {
+    case V4L2_PIX_FMT_MJPEG: ret = replay_index_mjpeg (rp); break;
+    case 0                 : ret = -1; break;
+    default                : ret = replay_index_annexb(rp); break;
+    }
+    if (ret < 0 || rp->nframes == 0) {
+        printf("replay: no frames found in %s !\n", file);
+        replay_close(&rp->src);
+        return NULL;
+    }
+    if (rp->fcc == V4L2_PIX_FMT_MJPEG) replay_size_mjpeg(rp);
+    if (rp->fcc == v4l2_fourcc('H','2','6','4')) replay_size_h264(rp);
+    printf("replay: %s, %.4s %dx%d, %d frames indexed\n", file, (char*)&rp->fcc, rp->width, rp->height, rp->nframes);
+
+    rp->src.paced = !fast;
+    rp->src.start = replay_start;
+    rp->src.read  = replay_read;
+    rp->src.close = replay_close;
+    return &rp->src;
+}
@@ -0,0 +1,292 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include "uvc_pool.h"
+#include "uvc_scale.h"
+
+/* ---------------------------------------------------------------------------
+ * Separable NV12 resampler. Each output row is first filtered vertically into
+ * a temporary row, sixteen pixels at a time with gcc vector extensions, then
+ * horizontally through precomputed taps. Weights are 8 bit and sum to 256.
+ */
+
+typedef uint8_t  v16b __attribute__((vector_size(16)));
+typedef uint16_t v16h __attribute__((vector_size(32)));
+
+struct scale_taps {
+    int       n;
+    int       m;
+    int       maxtaps;
+    int      *start;
+    uint8_t  *count;
+    uint16_t *w;
+};
+
+struct uvc_scale {
+    struct uvc_pool  *pool;
+    struct scale_taps yh, yv, ch, cv;
+    uint8_t          *tmp;
+    int               tmpcap;
+    int               njobs;
+
+    uint8_t          *dy, *duv;
+    const uint8_t    *sy, *suv;
+    int               dw, dh, dstride;
+    int               sw, sh, sstride;
+    int               uvfirst;
+};
+
+static void
+scale_free_taps(struct scale_taps *t)
+{
+    free(t->start);
+    free(t->count);
+    free(t->w);
+    memset(t, 0, sizeof(*t));
+}
+
+// taps mapping n source samples onto m destination samples
+static int
+scale_build_taps(struct scale_taps *t, int n, int m)
+{
+    int64_t a, b, lo, hi, x;
+    int     i, k, s, e, sum, big;
+    uint16_t *w;
+
+    if (t->n == n && t->m == m) return 0;
+    scale_free_taps(t);
+    t->maxtaps = n > m ? (n + m - 1) / m + 1 : 2;
+    t->start   = malloc(m * sizeof(int));
+    t->count   = malloc(m);
+    t->w       = calloc(m * t->maxtaps, sizeof(uint16_t));
+    if (!t->start || !t->count || !t->w) {
+        scale_free_taps(t);
+        return -1;
+    }
+
+    for (i=0; i<m; i++) {
+        w = t->w + i * t->maxtaps;
+        if (n > m) { // area: weight every source sample by its overlap with the output footprint
+            a = ((int64_t)i * n << 16) / m;
+            b = ((int64_t)(i + 1) * n << 16) / m;
+            s = a >> 16;
+            e = (b + 0xffff) >> 16;
+            if (e > n) e = n;
+            for (k=s; k<e; k++) {
+                lo = (int64_t)k << 16 > a ? (int64_t)k << 16 : a;
+                hi = (int64_t)(k + 1) << 16 < b ? (int64_t)(k + 1) << 16 : b;
+                w[k - s] = (hi - lo) * 256 / (b - a);
+            }
+            t->start[i] = s;
+            t->count[i] = e - s;
+        } else { // bilinear on sample centres
+            x = ((int64_t)(2 * i + 1) * n << 16) / (2 * m) - 0x8000;
+            if (x < 0) x = 0;
+            s = x >> 16;
+            t->start[i] = s;
+            if (s >= n - 1) {
+                t->start[i] = n - 1;
+                t->count[i] = 1;
+                w[0] = 256;
+            } else {
+                t->count[i] = 2;
+                w[1] = (x & 0xffff) >> 8;
+                w[0] = 256 - w[1];
+            }
+        }
+        for (k=0, sum=0, big=0; k<t->count[i]; k++) {
+            sum += w[k];
+            if (w[k] > w[big]) big = k;
+        }
+        w[big] += 256 - sum;
+    }
+    t->n = n;
+    t->m = m;
+    return 0;
+}
+
+static void
+scale_vert(uint8_t *out, const uint8_t *src, int stride, int width, const struct scale_taps *t, int j)
+{
+    const uint16_t *w   = t->w + j * t->maxtaps;
+    const uint8_t  *row = src + t->start[j] * stride;
+    int   cnt = t->count[j], x, k;
+    v16h  acc;
+    v16b  v;
+    unsigned int sum;
+
+    if (cnt == 1) {
+        memcpy(out, row, width);
+        return;
+    }
+    for (x=0; x+16<=width; x+=16) {
+        acc = (v16h){ 0 } + 128;
+        for (k=0; k<cnt; k++) {
+            memcpy(&v, row + k * stride + x, 16);
+            acc += __builtin_convertvector(v, v16h) * w[k];
+        }
+        v = __builtin_convertvector(acc >> 8, v16b);
+        memcpy(out + x, &v, 16);
+    }
+    for (; x<width; x++) {
+        for (k=0, sum=128; k<cnt; k++) sum += row[k * stride + x] * w[k];
+        out[x] = sum >> 8;
+    }
+}
+
+// pairs is the number of interleaved samples per output position, 1 for luma and 2 for uv
+static void
+scale_horz(uint8_t *out, const uint8_t *in, const struct scale_taps *t, int pairs)
+{
+    const uint16_t *w;
+    const uint8_t  *p;
+    unsigned int    sum;
+    int i, k, c;
+
+    if (t->n == t->m) {
+        memcpy(out, in, t->m * pairs);
+        return;
+    }
+    for (i=0; i<t->m; i++) {
+        w = t->w + i * t->maxtaps;
+        for (c=0; c<pairs; c++) {
+            p = in + t->start[i] * pairs + c;
+            for (k=0, sum=128; k<t->count[i]; k++) sum += p[k * pairs] * w[k];
+            out[i * pairs + c] = sum >> 8;
+        }
+    }
+}
+
+static void
+scale_job_proc(void *ctxt, int job)
+{
+    struct uvc_scale *sc  = (struct uvc_scale*)ctxt;
+    uint8_t          *tmp = sc->tmp + job * (sc->sw + 32);
+    int cw = (sc->sw + 1) / 2 * 2, ch = (sc->dh + 1) / 2;
+    int j, j0, j1;
+
+    j0 = sc->dh * job / sc->njobs;
+    j1 = sc->dh * (job + 1) / sc->njobs;
+    for (j=j0; j<j1; j++) {
+        scale_vert(tmp, sc->sy, sc->sstride, sc->sw, &sc->yv, j);
+        scale_horz(sc->dy + j * sc->dstride, tmp, &sc->yh, 1);
+    }
+
+    j0 = ch * job / sc->njobs;
+    j1 = ch * (job + 1) / sc->njobs;
+    for (j=j0; j<j1; j++) {
+        scale_vert(tmp, sc->suv, sc->sstride, cw, &sc->cv, j);
+        scale_horz(sc->duv + j * sc->dstride, tmp, &sc->ch, 2);
+    }
+}
+
+struct uvc_scale* uvc_scale_create(struct uvc_pool *pool)
+{
+    struct uvc_scale *sc = calloc(1, sizeof(*sc));
+    if (sc) sc->pool = pool;
+    return sc;
+}
+
+void uvc_scale_destroy(struct uvc_scale *sc)
+{
+    if (!sc) return;
+    scale_free_taps(&sc->yh);
+    scale_free_taps(&sc->yv);
+    scale_free_taps(&sc->ch);
+    scale_free_taps(&sc->cv);
+    free(sc->tmp);
+    free(sc);
+}
+
+int uvc_scale_nv12(struct uvc_scale *sc,
+                   uint8_t *dy, uint8_t *duv, int dw, int dh, int dstride,
+                   const uint8_t *sy, const uint8_t *suv, int sw, int sh, int sstride)
+{
+    int njobs, size;
+
+    if (dw <= 0 || dh <= 0 || sw <= 0 || sh <= 0) return -1;
+    if (scale_build_taps(&sc->yh, sw, dw) < 0 || scale_build_taps(&sc->yv, sh, dh) < 0 ||
+        scale_build_taps(&sc->ch, (sw + 1) / 2, (dw + 1) / 2) < 0 ||
+        scale_build_taps(&sc->cv, (sh + 1) / 2, (dh + 1) / 2) < 0) {
+        return -1;
+    }
+
+    // small frames are not worth the handoff to the workers
+    njobs = dw * dh >= 640 * 480 ? uvc_pool_size(sc->pool) * 2 : 1;
+    if (njobs > dh / 16) njobs = dh / 16 ? dh / 16 : 1;
+    size = njobs * (sw + 32);
+    if (size > sc->tmpcap) {
+        free(sc->tmp);
+        sc->tmp    = malloc(size);
+        sc->tmpcap = sc->tmp ? size : 0;
+        if (!sc->tmp) return -1;
+    }
+
+    sc->njobs = njobs;
+    sc->dy  = dy ; sc->duv = duv; sc->dw = dw; sc->dh = dh; sc->dstride = dstride;
+    sc->sy  = sy ; sc->suv = suv; sc->sw = sw; sc->sh = sh; sc->sstride = sstride;
+    uvc_pool_run(sc->pool, scale_job_proc, sc, njobs);
+    return 0;
+}
+
+/* ---------------------------------------------------------------------------
+ * NV12 to packed 4:2:2. A YUYV row is the luma row zipped with the interleaved
+ * chroma row of its pair of lines, UYVY the other way round, so every sixteen
+ * pixels come down to two byte shuffles.
+ */
+
+static void
+pack_row(uint8_t *out, const uint8_t *y, const uint8_t *uv, int width, int uvfirst)
+{
+    static const v16b lo = { 0, 16, 1, 17, 2, 18, 3, 19, 4 , 20, 5 , 21, 6 , 22, 7 , 23 };
+    static const v16b hi = { 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31 };
+    const uint8_t *a = uvfirst ? uv : y, *b = uvfirst ? y : uv;
+    v16b va, vb, v;
+    int  x;
+
+    for (x=0; x+16<=width; x+=16) {
+        memcpy(&va, a + x, 16);
+        memcpy(&vb, b + x, 16);
+        v = __builtin_shuffle(va, vb, lo);
+        memcpy(out + 2 * x, &v, 16);
+        v = __builtin_shuffle(va, vb, hi);
+        memcpy(out + 2 * x + 16, &v, 16);
+    }
+    for (; x<width; x++) {
+        out[2 * x + 0] = a[x];
+        out[2 * x + 1] = b[x];
+    }
+}
+
+static void
+pack_job_proc(void *ctxt, int job)
+{
+    struct uvc_scale *sc = (struct uvc_scale*)ctxt;
+    int j, j0, j1;
+
+    // whole line pairs per job so that the chroma row is fetched once
+    j0 = (sc->dh + 1) / 2 * job / sc->njobs * 2;
+    j1 = (sc->dh + 1) / 2 * (job + 1) / sc->njobs * 2;
+    if (j1 > sc->dh) j1 = sc->dh;
+    for (j=j0; j<j1; j++) {
+        pack_row(sc->dy + j * sc->dstride, sc->sy + j * sc->sstride, sc->suv + j / 2 * sc->sstride, sc->dw, sc->uvfirst);
+    }
+}
+
+int uvc_scale_pack(struct uvc_scale *sc, uint8_t *dst, unsigned int fcc, int w, int h, int dstride,
+                   const uint8_t *sy, const uint8_t *suv, int sstride)
+{
+    int njobs;
+
+    if (w <= 0 || h <= 0 || (fcc != V4L2_PIX_FMT_YUYV && fcc != V4L2_PIX_FMT_UYVY)) return -1;
+    njobs = w * h >= 640 * 480 ? uvc_pool_size(sc->pool) * 2 : 1;
+    if (njobs > h / 16) njobs = h / 16 ? h / 16 : 1;
+
+    sc->njobs   = njobs;
+    sc->uvfirst = fcc == V4L2_PIX_FMT_UYVY;
+    sc->dy  = dst; sc->dw  = w  ; sc->dh = h; sc->dstride = dstride;
+    sc->sy  = sy ; sc->suv = suv; sc->sstride = sstride;
+    uvc_pool_run(sc->pool, pack_job_proc, sc, njobs);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef __UVC_SCALE_H__
+#define __UVC_SCALE_H__
+
+#include <stdint.h>
+
+struct uvc_pool;
+struct uvc_scale;
+
+struct uvc_scale* uvc_scale_create (struct uvc_pool *pool);
+void              uvc_scale_destroy(struct uvc_scale *sc);
+
+// resize one NV12 picture, area averaging when shrinking and bilinear when growing,
+// filter taps are cached per geometry and rows are split across the pool
+int uvc_scale_nv12(struct uvc_scale *sc,
+                   uint8_t *dy, uint8_t *duv, int dw, int dh, int dstride,
+                   const uint8_t *sy, const uint8_t *suv, int sw, int sh, int sstride);
+
+// interleave one NV12 picture into packed 4:2:2, fcc is V4L2_PIX_FMT_YUYV or UYVY,
+// each chroma row serves both of its lines, rows are split across the pool
+int uvc_scale_pack(struct uvc_scale *sc, uint8_t *dst, unsigned int fcc, int w, int h, int dstride,
+                   const uint8_t *sy, const uint8_t *suv, int sstride);
+
+#endif
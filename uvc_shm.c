@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <linux/videodev2.h>
+#include "uvc_source.h"
+
+/* ---------------------------------------------------------------------------
+ * memfd frame ring shared with an out-of-process producer. The producer
+ * writes frames straight into the slots, libuvc reads them in place and the
+ * slot is only handed back once the frame went out. head and tail are free
+ * running counters, one writer and one reader. The memfd and both eventfds
+ * reach the producer over a unix socket.
+ */
+
+#define SHM_MAGIC   0x6d687375 // "ushm"
+#define SHM_VERSION 1
+
+struct shm_slot {
+    uint32_t len;
+    uint32_t fcc;
+    int32_t  width;
+    int32_t  height;
+    int32_t  yoff;
+    int32_t  uoff;
+};
+
+struct shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t slotsize;
+    uint32_t dataoff;
+    uint32_t head;     // next slot the producer fills
+    uint32_t tail;     // next slot libuvc reads
+    uint32_t fmtseq;   // bumped whenever the committed format below changes
+    uint32_t fcc;
+    int32_t  width;
+    int32_t  height;
+    struct shm_slot slots[];
+};
+
+struct shm_map {
+    struct shm_header *hdr;
+    size_t             size;
+    int                memfd;
+    int                efd_ready; // producer -> libuvc
+    int                efd_free;  // libuvc -> producer
+};
+
+static void
+shm_unmap(struct shm_map *m)
+{
+    if (m->hdr) munmap(m->hdr, m->size);
+    if (m->memfd     >= 0) close(m->memfd);
+    if (m->efd_ready >= 0) close(m->efd_ready);
+    if (m->efd_free  >= 0) close(m->efd_free);
+}
+
+static void
+shm_kick(int efd)
+{
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) < 0) {} // counter saturation only, the reader wakes anyway
+}
+
+// waits until efd is signalled or timeout ms pass, extra fd is polled alongside
+static int
+shm_wait(int efd, int extra, int timeout)
+{
+    struct pollfd pfd[2] = { { efd, POLLIN, 0 }, { extra, POLLIN, 0 } };
+    uint64_t cnt;
+    int ret;
+
+    ret = poll(pfd, extra >= 0 ? 2 : 1, timeout);
+    if (ret > 0 && (pfd[0].revents & POLLIN)) {
+        if (read(efd, &cnt, sizeof(cnt)) < 0) {}
+    }
+    return ret;
+}
+
+/* ---------------------------------------------------------------------------
+ * libuvc side, a uvc_source
+ */
+
+struct uvc_shm {
+    struct uvc_source src;
+    struct shm_map    map;
+    int               listenfd;
+    char              path[108];
+    int               holding;
+    uint32_t          nslots;   // ring geometry, the header copy is the producer's to write
+    uint32_t          slotsize;
+    uint32_t          dataoff;
+    unsigned int      fcc;      // committed format, what slots without one are
+    int               width;
+    int               height;
+};
+
+static void
+shm_accept(struct uvc_shm *sh)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    int  fds[3] = { sh->map.memfd, sh->map.efd_ready, sh->map.efd_free };
+    char ver = SHM_VERSION;
+    int  fd;
+
+    fd = accept(sh->listenfd, NULL, NULL);
+    if (fd < 0) return;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    iov.iov_base       = &ver;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+        printf("shm: unable to pass ring to producer: %s (%d)\n", strerror(errno), errno);
+    } else {
+        printf("shm: producer connected\n");
+    }
+    close(fd);
+}
+
+static int
+shm_start(struct uvc_source *src, unsigned int fcc, int width, int height)
+{
+    struct uvc_shm    *sh  = (struct uvc_shm*)src;
+    struct shm_header *hdr = sh->map.hdr;
+
+    sh->fcc    = fcc;
+    sh->width  = width;
+    sh->height = height;
+
+    // the producer learns what to make through the ring header
+    hdr->fcc    = fcc;
+    hdr->width  = width;
+    hdr->height = height;
+    __atomic_add_fetch(&hdr->fmtseq, 1, __ATOMIC_RELEASE);
+    shm_kick(sh->map.efd_free);
+    return 0;
+}
+
+// a slot is only passed on if everything the fill paths read lies within its len,
+// for NV12 that is both planes at the size it claims
+static int
+shm_slot_ok(struct uvc_shm *sh, const struct shm_slot *slot)
+{
+    unsigned int fcc = slot->fcc    ? slot->fcc    : sh->fcc;
+    int64_t      w   = slot->width  ? slot->width  : sh->width;
+    int64_t      h   = slot->height ? slot->height : sh->height;
+
+    if (slot->len > sh->slotsize || slot->yoff < 0 || slot->uoff < 0) return 0;
+    if (fcc != V4L2_PIX_FMT_NV12) return 1;
+    if (w <= 0 || h <= 0 || w > 8192 || h > 8192) return 0;
+    return slot->yoff + w * h <= slot->len && slot->uoff + w * h / 2 <= slot->len;
+}
+
+static int
+shm_read(struct uvc_source *src, struct camuvc_frame *frame)
+{
+    struct uvc_shm    *sh  = (struct uvc_shm*)src;
+    struct shm_header *hdr = sh->map.hdr;
+    struct shm_slot    slot;
+    uint32_t head, tail, i;
+
+    // the previous frame has gone out by now, its slot goes back to the producer
+    if (sh->holding) {
+        __atomic_add_fetch(&hdr->tail, 1, __ATOMIC_RELEASE);
+        shm_kick(sh->map.efd_free);
+        sh->holding = 0;
+    }
+
+    for (;;) {
+        tail = hdr->tail;
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if (head != tail) break;
+        // short timeout so that the capture thread still notices exit
+        if (shm_wait(sh->map.efd_ready, sh->listenfd, 100) <= 0) return -1;
+        shm_accept(sh);
+    }
+
+    // the producer can still scribble on the slot, check a private copy
+    i    = tail % sh->nslots;
+    slot = hdr->slots[i];
+    memset(frame, 0, sizeof(*frame));
+    if (head - tail > sh->nslots || !shm_slot_ok(sh, &slot)) {
+        printf("shm: bad slot %u from producer, dropped !\n", i);
+        __atomic_store_n(&hdr->tail, head, __ATOMIC_RELEASE);
+        shm_kick(sh->map.efd_free);
+        return -1;
+    }
+    frame->data   = (uint8_t*)hdr + sh->dataoff + (size_t)i * sh->slotsize;
+    frame->len    = slot.len;
+    frame->fcc    = slot.fcc;
+    frame->width  = slot.width;
+    frame->height = slot.height;
+    frame->yoff   = slot.yoff;
+    frame->uoff   = slot.uoff;
+    sh->holding   = 1;
+    return 0;
+}
+
+static void
+shm_close(struct uvc_source *src)
+{
+    struct uvc_shm *sh = (struct uvc_shm*)src;
+    if (sh->listenfd >= 0) {
+        close(sh->listenfd);
+        unlink(sh->path);
+    }
+    shm_unmap(&sh->map);
+    free(sh);
+}
+
+struct uvc_source* uvc_shm_open(const char *path, int nslots, int slotsize)
+{
+    struct sockaddr_un addr;
+    struct uvc_shm *sh;
+    uint32_t dataoff;
+
+    if (nslots < 2 || nslots > 64 || slotsize <= 0 || strlen(path) >= sizeof(addr.sun_path)) return NULL;
+    sh = calloc(1, sizeof(*sh));
+    if (!sh) return NULL;
+    sh->listenfd      = -1;
+    sh->map.efd_ready = -1;
+    sh->map.efd_free  = -1;
+    snprintf(sh->path, sizeof(sh->path), "%s", path);
+
+    slotsize = (slotsize + 4095) & ~4095;
+    dataoff  = (sizeof(struct shm_header) + nslots * sizeof(struct shm_slot) + 4095) & ~4095;
+    sh->map.size  = dataoff + (size_t)nslots * slotsize;
+    sh->map.memfd = memfd_create("camuvc-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (sh->map.memfd < 0 || ftruncate(sh->map.memfd, sh->map.size) < 0) {
+        printf("shm: unable to create ring: %s (%d)\n", strerror(errno), errno);
+        goto failed;
+    }
+    // a producer must not be able to pull the mapping out from under us
+    fcntl(sh->map.memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    sh->map.hdr = mmap(NULL, sh->map.size, PROT_READ | PROT_WRITE, MAP_SHARED, sh->map.memfd, 0);
+    if (sh->map.hdr == MAP_FAILED) {
+        sh->map.hdr = NULL;
+        goto failed;
+    }
+    sh->map.hdr->magic    = SHM_MAGIC;
+    sh->map.hdr->version  = SHM_VERSION;
+    sh->map.hdr->nslots   = nslots;
+    sh->map.hdr->slotsize = slotsize;
+    sh->map.hdr->dataoff  = dataoff;
+    sh->nslots   = nslots;
+    sh->slotsize = slotsize;
+    sh->dataoff  = dataoff;
+
+    sh->map.efd_ready = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    sh->map.efd_free  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    sh->listenfd      = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sh->map.efd_ready < 0 || sh->map.efd_free < 0 || sh->listenfd < 0) goto failed;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (bind(sh->listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sh->listenfd, 4) < 0) {
+        printf("shm: unable to listen on %s: %s (%d)\n", path, strerror(errno), errno);
+        goto failed;
+    }
+    printf("shm: %s, %d slots of %d bytes\n", path, nslots, slotsize);
+
+    sh->src.paced = 0;
+    sh->src.start = shm_start;
+    sh->src.read  = shm_read;
+    sh->src.close = shm_close;
+    return &sh->src;
+
+failed:
+    if (sh->listenfd >= 0) close(sh->listenfd);
+    sh->listenfd = -1;
+    shm_close(&sh->src);
+    return NULL;
+}
+
+/* ---------------------------------------------------------------------------
+ * Producer side client
+ */
+
+struct camuvc_shm {
+    struct shm_map map;
+    uint32_t       fmtseq;
+};
+
+struct camuvc_shm* camuvc_shm_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    struct camuvc_shm *shm;
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    struct stat     st;
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    int  fds[3], fd;
+    char ver = 0;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = &ver;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) <= 0 || ver != SHM_VERSION || !(cmsg = CMSG_FIRSTHDR(&msg)) ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    shm = calloc(1, sizeof(*shm));
+    if (!shm) {
+        close(fds[0]); close(fds[1]); close(fds[2]);
+        return NULL;
+    }
+    shm->map.memfd     = fds[0];
+    shm->map.efd_ready = fds[1];
+    shm->map.efd_free  = fds[2];
+    if (fstat(shm->map.memfd, &st) < 0 || st.st_size < (off_t)sizeof(struct shm_header)) goto failed;
+    shm->map.size = st.st_size;
+    shm->map.hdr  = mmap(NULL, shm->map.size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->map.memfd, 0);
+    if (shm->map.hdr == MAP_FAILED) {
+        shm->map.hdr = NULL;
+        goto failed;
+    }
+    if (shm->map.hdr->magic != SHM_MAGIC || shm->map.hdr->dataoff + (size_t)shm->map.hdr->nslots * shm->map.hdr->slotsize > shm->map.size) goto failed;
+    return shm;
+
+failed:
+    camuvc_shm_disconnect(shm);
+    return NULL;
+}
+
+void camuvc_shm_disconnect(struct camuvc_shm *shm)
+{
+    if (!shm) return;
+    shm_unmap(&shm->map);
+    free(shm);
+}
+
+uint8_t* camuvc_shm_acquire(struct camuvc_shm *shm, int *size, int timeout)
+{
+    struct shm_header *hdr = shm->map.hdr;
+    uint32_t head = hdr->head;
+
+    while (head - __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) >= hdr->nslots) {
+        if (shm_wait(shm->map.efd_free, -1, timeout) <= 0) return NULL;
+    }
+    if (size) *size = hdr->slotsize;
+    return (uint8_t*)hdr + hdr->dataoff + (size_t)(head % hdr->nslots) * hdr->slotsize;
+}
+
+int camuvc_shm_commit(struct camuvc_shm *shm, const struct camuvc_frame *frame)
+{
+    struct shm_header *hdr  = shm->map.hdr;
+    struct shm_slot   *slot = &hdr->slots[hdr->head % hdr->nslots];
+
+    if (frame->len < 0 || (uint32_t)frame->len > hdr->slotsize) return -1;
+    if (hdr->head - __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) >= hdr->nslots) return -1;
+    slot->len    = frame->len;
+    slot->fcc    = frame->fcc;
+    slot->width  = frame->width;
+    slot->height = frame->height;
+    slot->yoff   = frame->yoff;
+    slot->uoff   = frame->uoff;
+    __atomic_add_fetch(&hdr->head, 1, __ATOMIC_RELEASE);
+    shm_kick(shm->map.efd_ready);
+    return 0;
+}
+
+int camuvc_shm_format(struct camuvc_shm *shm, unsigned int *fcc, int *width, int *height)
+{
+    struct shm_header *hdr = shm->map.hdr;
+    uint32_t seq = __atomic_load_n(&hdr->fmtseq, __ATOMIC_ACQUIRE);
+    int changed  = seq != shm->fmtseq;
+
+    shm->fmtseq = seq;
+    if (fcc   ) *fcc    = hdr->fcc;
+    if (width ) *width  = hdr->width;
+    if (height) *height = hdr->height;
+    return changed;
+}
@@ -0,0 +1,29 @@
+#ifndef __UVC_SOURCE_H__
+#define __UVC_SOURCE_H__
+
+#include <stdint.h>
+#include "camuvc.h"
+
+// built-in frame source, driven by main_video_capture_proc()
+struct uvc_source {
+    int   paced; // deliver frames at the committed frame interval
+    int  (*start)(struct uvc_source *src, unsigned int fcc, int width, int height);
+    int  (*read )(struct uvc_source *src, struct camuvc_frame *frame);
+    void (*close)(struct uvc_source *src);
+};
+
+struct uvc_source* uvc_replay_open(const char *file, int fast);
+struct uvc_source* uvc_shm_open   (const char *path, int nslots, int slotsize);
+struct uvc_source* uvc_push_open  (int depth);
+struct uvc_source* uvc_pattern_open(int pattern, int fast);
+struct uvc_source* uvc_capture_open(const char *devname);
+
+// in-process producer queue behind camuvc_push()
+int uvc_push_frame (struct uvc_source *src, const struct camuvc_frame *frame,
+                    void (*release)(void *opaque, const struct camuvc_frame *frame), void *opaque, int timeout);
+int uvc_push_fd    (struct uvc_source *src);
+int uvc_push_queued(struct uvc_source *src, int *depth);
+// hands every queued frame back, all: the one read last as well, only where nothing reads from it
+void uvc_push_flush (struct uvc_source *src, int all);
+
+#endif
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include "uvc_trace.h"
+#include "camuvc.h"
+
+/* ---------------------------------------------------------------------------
+ * Stage tracing. Markers go to ftrace's trace_marker in the atrace format
+ * perfetto and systrace understand, so they line up with kernel usb and
+ * sched events, and/or into an in-memory ring that is written out as
+ * chrome trace event json. The ring keeps the most recent events.
+ */
+
+struct trace_event {
+    int64_t     ts;
+    const char *name;
+    int         tid;
+    char        phase;
+};
+
+int g_uvc_trace = 0;
+
+static int                 g_trace_flags;
+static int                 g_trace_marker = -1;
+static struct trace_event *g_trace_ring;
+static unsigned int        g_trace_size;
+static unsigned int        g_trace_next;
+static int                 g_trace_users; // writers inside uvc_trace_event(), stop waits them out
+
+static int
+trace_tid(void)
+{
+    static __thread int tid;
+    if (!tid) tid = syscall(SYS_gettid);
+    return tid;
+}
+
+void uvc_trace_event(char phase, const char *name)
+{
+    struct trace_event *e;
+    struct timespec     ts;
+    char   buf[96];
+    int    len;
+
+    // announce ourselves before looking at the switch again, stop clears the switch
+    // before counting us, so either it waits for us or we see tracing is off
+    __atomic_add_fetch(&g_trace_users, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&g_uvc_trace, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&g_trace_users, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if ((g_trace_flags & CAMUVC_TRACE_MARKER) && g_trace_marker >= 0) {
+        len = phase == 'B' ? snprintf(buf, sizeof(buf), "B|%d|%s", getpid(), name) : snprintf(buf, sizeof(buf), "E|%d", getpid());
+        if (write(g_trace_marker, buf, len) < 0) {}
+    }
+    if (g_trace_ring) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        e = &g_trace_ring[__atomic_fetch_add(&g_trace_next, 1, __ATOMIC_RELAXED) % g_trace_size];
+        e->ts    = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        e->name  = name;
+        e->tid   = trace_tid();
+        e->phase = phase;
+    }
+    __atomic_sub_fetch(&g_trace_users, 1, __ATOMIC_RELEASE);
+}
+
+int camuvc_trace_start(int flags, int nevents)
+{
+    if (g_uvc_trace) return -1;
+    if (flags & CAMUVC_TRACE_MARKER) {
+        g_trace_marker = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (g_trace_marker < 0) g_trace_marker = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (g_trace_marker < 0) {
+            printf("trace: no trace_marker: %s (%d)\n", strerror(errno), errno);
+            flags &= ~CAMUVC_TRACE_MARKER;
+        }
+    }
+    if (flags & CAMUVC_TRACE_MEMORY) {
+        g_trace_size = nevents > 0 ? nevents : 65536;
+        g_trace_next = 0;
+        g_trace_ring = calloc(g_trace_size, sizeof(struct trace_event));
+        if (!g_trace_ring) flags &= ~CAMUVC_TRACE_MEMORY;
+    }
+    g_trace_flags = flags;
+    __atomic_store_n(&g_uvc_trace, !!flags, __ATOMIC_RELEASE);
+    return flags ? 0 : -1;
+}
+
+int camuvc_trace_stop(const char *file)
+{
+    struct trace_event *e;
+    unsigned int i, first, n;
+    FILE *fp = NULL;
+    int   pid = getpid();
+
+    if (!g_uvc_trace) return -1;
+    __atomic_store_n(&g_uvc_trace, 0, __ATOMIC_SEQ_CST);
+    // the ring and the marker fd go away below, no writer may still be using them
+    while (__atomic_load_n(&g_trace_users, __ATOMIC_SEQ_CST)) sched_yield();
+
+    if (g_trace_ring && file && (fp = fopen(file, "w"))) {
+        n     = g_trace_next < g_trace_size ? g_trace_next : g_trace_size;
+        first = g_trace_next - n;
+        fprintf(fp, "{\"traceEvents\":[\n");
+        for (i=0; i<n; i++) {
+            e = &g_trace_ring[(first + i) % g_trace_size];
+            fprintf(fp, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03d,\"pid\":%d,\"tid\":%d}%s\n", e->name, e->phase,
+                    (long long)(e->ts / 1000), (int)(e->ts % 1000), pid, e->tid, i + 1 < n ? "," : "");
+        }
+        fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(fp);
+    } else if (g_trace_ring && file) {
+        printf("trace: unable to write %s: %s (%d)\n", file, strerror(errno), errno);
+    }
+
+    if (g_trace_marker >= 0) close(g_trace_marker);
+    g_trace_marker = -1;
+    free(g_trace_ring);
+    g_trace_ring  = NULL;
+    g_trace_flags = 0;
+    return 0;
+}
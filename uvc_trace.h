@@ -0,0 +1,13 @@
+#ifndef __UVC_TRACE_H__
+#define __UVC_TRACE_H__
+
+// begin/end markers around pipeline stages, names must be string literals.
+// a predicted-not-taken branch on one global when tracing is off
+extern int g_uvc_trace;
+
+void uvc_trace_event(char phase, const char *name);
+
+#define UVC_TRACE_BEGIN(name) do { if (__builtin_expect(g_uvc_trace, 0)) uvc_trace_event('B', name); } while (0)
+#define UVC_TRACE_END(name)   do { if (__builtin_expect(g_uvc_trace, 0)) uvc_trace_event('E', name); } while (0)
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "uvc_venc.h"
+
+struct venc_entry {
+    struct camuvc_venc_params params;
+    void                     *sess;
+    unsigned int              used;
+};
+
+struct uvc_venc {
+    const struct camuvc_venc_ops *ops;
+    void                         *priv;
+    struct venc_entry            *entries;
+    int                           maxsess;
+    int                           nsess;
+    unsigned int                  tick;
+    void                         *cur;
+};
+
+struct uvc_venc* uvc_venc_create(const struct camuvc_venc_ops *ops, void *priv, int maxsess)
+{
+    struct uvc_venc *venc;
+
+    if (!ops || !ops->open || !ops->read || !ops->close) return NULL;
+    if (maxsess <= 0) maxsess = 1;
+    venc = calloc(1, sizeof(*venc));
+    if (!venc) return NULL;
+    venc->entries = calloc(maxsess, sizeof(struct venc_entry));
+    if (!venc->entries) {
+        free(venc);
+        return NULL;
+    }
+    venc->ops     = ops;
+    venc->priv    = priv;
+    venc->maxsess = maxsess;
+    return venc;
+}
+
+static void
+venc_drop(struct uvc_venc *venc, int i)
+{
+    venc->ops->close(venc->priv, venc->entries[i].sess);
+    if (venc->cur == venc->entries[i].sess) venc->cur = NULL;
+    venc->entries[i] = venc->entries[--venc->nsess];
+}
+
+void uvc_venc_destroy(struct uvc_venc *venc)
+{
+    if (!venc) return;
+    while (venc->nsess) venc_drop(venc, venc->nsess - 1);
+    free(venc->entries);
+    free(venc);
+}
+
+static void*
+venc_switch(struct uvc_venc *venc, struct venc_entry *e)
+{
+    e->used = ++venc->tick;
+    if (venc->cur != e->sess && venc->ops->pause) {
+        if (venc->cur) venc->ops->pause(venc->priv, venc->cur, 1);
+        venc->ops->pause(venc->priv, e->sess, 0);
+    }
+    venc->cur = e->sess;
+    return e->sess;
+}
+
+void* uvc_venc_get(struct uvc_venc *venc, const struct camuvc_venc_params *params, int *fresh)
+{
+    struct venc_entry *e;
+    int i, changed, lru;
+
+    *fresh = 0;
+    for (i=0; i<venc->nsess; i++) {
+        e = &venc->entries[i];
+        if (e->params.fcc != params->fcc || e->params.width != params->width || e->params.height != params->height) continue;
+
+        changed  = e->params.interval != params->interval ? CAMUVC_VENC_INTERVAL : 0;
+        changed |= e->params.bitrate  != params->bitrate  ? CAMUVC_VENC_BITRATE  : 0;
+        if (changed) {
+            if (!venc->ops->reconfig || venc->ops->reconfig(venc->priv, e->sess, params, changed) < 0) {
+                printf("venc: reconfig of %.4s %dx%d failed, reopening\n", (char*)&params->fcc, params->width, params->height);
+                venc_drop(venc, i);
+                break;
+            }
+            e->params = *params;
+        }
+        return venc_switch(venc, e);
+    }
+
+    if (venc->nsess == venc->maxsess) {
+        for (i=1, lru=0; i<venc->nsess; i++) {
+            if (venc->entries[i].used < venc->entries[lru].used) lru = i;
+        }
+        venc_drop(venc, lru);
+    }
+
+    if (venc->cur && venc->ops->pause) venc->ops->pause(venc->priv, venc->cur, 1);
+    venc->cur = NULL;
+
+    e = &venc->entries[venc->nsess];
+    e->sess = venc->ops->open(venc->priv, params);
+    if (!e->sess) {
+        printf("venc: unable to open %.4s %dx%d\n", (char*)&params->fcc, params->width, params->height);
+        return NULL;
+    }
+    e->params = *params;
+    venc->nsess++;
+    *fresh = 1;
+    return venc_switch(venc, e);
+}
+
+// live change of one parameter on the current session
+static int
+venc_set_param(struct uvc_venc *venc, int changed, int value)
+{
+    struct camuvc_venc_params params;
+    struct venc_entry *e;
+    int i;
+
+    for (i=0; i<venc->nsess; i++) {
+        e = &venc->entries[i];
+        if (e->sess != venc->cur) continue;
+        params = e->params;
+        if (changed == CAMUVC_VENC_BITRATE) params.bitrate  = value;
+        else                                params.interval = value;
+        if (!memcmp(&params, &e->params, sizeof(params))) return 0;
+        if (!venc->ops->reconfig || venc->ops->reconfig(venc->priv, e->sess, &params, changed) < 0) return -1;
+        e->params = params;
+        return 0;
+    }
+    return -1;
+}
+
+int uvc_venc_set_bitrate(struct uvc_venc *venc, int bitrate)
+{
+    return venc_set_param(venc, CAMUVC_VENC_BITRATE, bitrate);
+}
+
+int uvc_venc_set_interval(struct uvc_venc *venc, int interval)
+{
+    return venc_set_param(venc, CAMUVC_VENC_INTERVAL, interval);
+}
@@ -0,0 +1,20 @@
+#ifndef __UVC_VENC_H__
+#define __UVC_VENC_H__
+
+#include "camuvc.h"
+
+// cache of open encoder sessions around the platform camuvc_venc_ops
+struct uvc_venc;
+
+struct uvc_venc* uvc_venc_create (const struct camuvc_venc_ops *ops, void *priv, int maxsess);
+void             uvc_venc_destroy(struct uvc_venc *venc);
+
+// returns a session for params, reusing or reconfiguring a cached one where possible,
+// *fresh is set when the session was just opened and starts with an IDR anyway
+void* uvc_venc_get(struct uvc_venc *venc, const struct camuvc_venc_params *params, int *fresh);
+
+// live bitrate or frame interval change on the current session through ops->reconfig
+int   uvc_venc_set_bitrate (struct uvc_venc *venc, int bitrate);
+int   uvc_venc_set_interval(struct uvc_venc *venc, int interval); // 100ns units
+
+#endif
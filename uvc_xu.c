@@ -0,0 +1,267 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "linux/video.h"
+#include "uvc_xu.h"
+
+/* ---------------------------------------------------------------------------
+ * Extension unit controls. Requests are answered on the event thread from
+ * what is known right now, the handlers run later on the workers: SET_CUR
+ * takes its data stage and returns, GET_CUR returns the cached value and
+ * queues a refresh. A control runs one handler at a time, a SET_CUR that
+ * arrives while a set is still busy stalls with "not ready", one that comes
+ * during a refresh is queued and runs right after it.
+ */
+
+#define XU_MAX_CTRLS   32
+#define XU_MAX_WORKERS 4
+
+// bmRequestErrorCode values
+#define XU_ERR_NONE      0x00
+#define XU_ERR_NOT_READY 0x01
+#define XU_ERR_CONTROL   0x06
+#define XU_ERR_REQUEST   0x07
+
+// GET_INFO bits
+#define XU_INFO_GET   (1 << 0)
+#define XU_INFO_SET   (1 << 1)
+
+struct xu_ctrl {
+    int           unit;
+    int           cs;
+    int           size;
+    uvc_xu_get_fn get;
+    uvc_xu_set_fn set;
+    void         *priv;
+    uint8_t       cur[60];   // what GET_CUR answers
+    uint8_t       def[60];
+    uint8_t       pend[60];  // value for the queued set
+    int           haspend;
+    int           refresh;   // queued get
+    int           busy;      // a worker runs one of the handlers, XU_BUSY_*
+};
+
+#define XU_BUSY_SET 1
+#define XU_BUSY_GET 2
+
+struct uvc_xu {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    pthread_t       threads[XU_MAX_WORKERS];
+    int             nthreads;
+    int             exit;
+    struct xu_ctrl  ctrls[XU_MAX_CTRLS];
+    int             nctrls;
+    struct xu_ctrl *target;  // SET_CUR waiting for its data stage
+    uint8_t         error;   // answer to the request error code control
+};
+
+// next control with work that no worker has taken yet, called with the mutex held
+static struct xu_ctrl*
+xu_next_job(struct uvc_xu *xu)
+{
+    int i;
+    for (i=0; i<xu->nctrls; i++) {
+        if (!xu->ctrls[i].busy && (xu->ctrls[i].haspend || xu->ctrls[i].refresh)) return &xu->ctrls[i];
+    }
+    return NULL;
+}
+
+static void* xu_thread_proc(void *argv)
+{
+    struct uvc_xu  *xu = (struct uvc_xu*)argv;
+    struct xu_ctrl *c;
+    uint8_t data[60];
+    int     set, ret;
+
+    pthread_mutex_lock(&xu->mutex);
+    while (1) {
+        while (!xu->exit && !(c = xu_next_job(xu))) pthread_cond_wait(&xu->cond, &xu->mutex);
+        if (xu->exit) break;
+
+        // sets go first, a refresh queued behind one reads the new value
+        set = c->haspend;
+        if (set) memcpy(data, c->pend, c->size);
+        else     memcpy(data, c->cur , c->size);
+        c->haspend = 0;
+        c->refresh = set ? c->refresh : 0;
+        c->busy    = set ? XU_BUSY_SET : XU_BUSY_GET;
+        pthread_mutex_unlock(&xu->mutex);
+
+        ret = set ? c->set(c->priv, c->unit, c->cs, data, c->size) : c->get(c->priv, c->unit, c->cs, data, c->size);
+        if (ret < 0) printf("xu unit %d cs %d: %s failed (%d)\n", c->unit, c->cs, set ? "set" : "get", ret);
+
+        pthread_mutex_lock(&xu->mutex);
+        // what a refresh read is already stale when a set came in meanwhile
+        if (ret >= 0 && (set || !c->haspend)) memcpy(c->cur, data, c->size);
+        // a failed set left cur at the value that was asked for, read back the real one
+        if (ret < 0 && set && c->get) c->refresh = 1;
+        c->busy = 0;
+    }
+    pthread_mutex_unlock(&xu->mutex);
+    return NULL;
+}
+
+struct uvc_xu* uvc_xu_create(int nworkers)
+{
+    struct uvc_xu *xu;
+    int i;
+
+    xu = calloc(1, sizeof(*xu));
+    if (!xu) return NULL;
+    pthread_mutex_init(&xu->mutex, NULL);
+    pthread_cond_init (&xu->cond , NULL);
+    if (nworkers <= 0 || nworkers > XU_MAX_WORKERS) nworkers = 2;
+    for (i=0; i<nworkers; i++) {
+        if (pthread_create(&xu->threads[i], NULL, xu_thread_proc, xu) != 0) break;
+    }
+    xu->nthreads = i;
+    if (!xu->nthreads) {
+        uvc_xu_destroy(xu);
+        return NULL;
+    }
+    return xu;
+}
+
+void uvc_xu_destroy(struct uvc_xu *xu)
+{
+    int i;
+    if (!xu) return;
+
+    pthread_mutex_lock(&xu->mutex);
+    xu->exit = 1;
+    pthread_cond_broadcast(&xu->cond);
+    pthread_mutex_unlock(&xu->mutex);
+    for (i=0; i<xu->nthreads; i++) pthread_join(xu->threads[i], NULL);
+    pthread_cond_destroy (&xu->cond );
+    pthread_mutex_destroy(&xu->mutex);
+    free(xu);
+}
+
+static struct xu_ctrl*
+xu_find(struct uvc_xu *xu, int unit, int cs)
+{
+    int i;
+    for (i=0; i<xu->nctrls; i++) {
+        if (xu->ctrls[i].unit == unit && xu->ctrls[i].cs == cs) return &xu->ctrls[i];
+    }
+    return NULL;
+}
+
+int uvc_xu_add(struct uvc_xu *xu, int unit, int cs, int size, uvc_xu_get_fn get, uvc_xu_set_fn set, void *priv)
+{
+    struct xu_ctrl *c;
+    uint8_t cur[60];
+
+    if (unit <= 0 || unit > 255 || cs <= 0 || cs > 255 || size <= 0 || size > (int)sizeof(cur) || (!get && !set)) return -1;
+    // the first read fills the cache, and is what GET_DEF answers from then on
+    memset(cur, 0, sizeof(cur));
+    if (get && get(priv, unit, cs, cur, size) < 0) memset(cur, 0, sizeof(cur));
+
+    pthread_mutex_lock(&xu->mutex);
+    if (!(c = xu_find(xu, unit, cs))) {
+        if (xu->nctrls == XU_MAX_CTRLS) {
+            pthread_mutex_unlock(&xu->mutex);
+            return -1;
+        }
+        c = &xu->ctrls[xu->nctrls++];
+        memset(c, 0, sizeof(*c));
+    } else if (c->busy) {
+        pthread_mutex_unlock(&xu->mutex);
+        return -1;
+    }
+    c->unit = unit;
+    c->cs   = cs;
+    c->size = size;
+    c->get  = get;
+    c->set  = set;
+    c->priv = priv;
+    memcpy(c->cur, cur, size);
+    memcpy(c->def, cur, size);
+    pthread_mutex_unlock(&xu->mutex);
+    return 0;
+}
+
+int uvc_xu_setup(struct uvc_xu *xu, int unit, int req, int cs, struct uvc_request_data *resp)
+{
+    struct xu_ctrl *c;
+    int    error = XU_ERR_NONE;
+
+    pthread_mutex_lock(&xu->mutex);
+    xu->target = NULL;
+    if (unit == 0 && cs == UVC_VC_REQUEST_ERROR_CODE_CONTROL && req == UVC_GET_CUR) {
+        resp->data[0] = xu->error;
+        resp->length  = 1;
+        pthread_mutex_unlock(&xu->mutex);
+        return 1;
+    }
+    if (!(c = xu_find(xu, unit, cs))) {
+        // a unit of ours with a selector nobody registered
+        for (c=xu->ctrls; c<xu->ctrls+xu->nctrls && c->unit!=unit; c++);
+        if (c == xu->ctrls + xu->nctrls) {
+            pthread_mutex_unlock(&xu->mutex);
+            return 0;
+        }
+        xu->error = XU_ERR_CONTROL;
+        pthread_mutex_unlock(&xu->mutex);
+        return 1; // stalled
+    }
+
+    switch (req) {
+    case UVC_SET_CUR:
+        if (!c->set) { error = XU_ERR_REQUEST; break; }
+        if (c->busy == XU_BUSY_SET || c->haspend) { error = XU_ERR_NOT_READY; break; }
+        xu->target   = c;
+        resp->length = c->size;
+        break;
+    case UVC_GET_CUR:
+        memcpy(resp->data, c->cur, c->size);
+        resp->length = c->size;
+        if (c->get && !c->refresh) {
+            c->refresh = 1;
+            pthread_cond_signal(&xu->cond);
+        }
+        break;
+    case UVC_GET_DEF:
+        memcpy(resp->data, c->def, c->size);
+        resp->length = c->size;
+        break;
+    case UVC_GET_LEN:
+        resp->data[0] = c->size & 0xff;
+        resp->data[1] = c->size >> 8;
+        resp->length  = 2;
+        break;
+    case UVC_GET_INFO:
+        // not asynchronous (D4), there is no status interrupt to complete a set with and
+        // the host would hold the control for the setting handle until one arrives
+        resp->data[0] = XU_INFO_GET | (c->set ? XU_INFO_SET : 0);
+        resp->length  = 1;
+        break;
+    default:
+        error = XU_ERR_REQUEST;
+        break;
+    }
+    xu->error = error;
+    pthread_mutex_unlock(&xu->mutex);
+    return 1;
+}
+
+void uvc_xu_data(struct uvc_xu *xu, const struct uvc_request_data *data)
+{
+    struct xu_ctrl *c;
+
+    pthread_mutex_lock(&xu->mutex);
+    if ((c = xu->target) != NULL) {
+        memset(c->pend, 0, c->size);
+        memcpy(c->pend, data->data, data->length < c->size ? (data->length > 0 ? data->length : 0) : c->size);
+        // GET_CUR answers the new value while set() is still running
+        memcpy(c->cur, c->pend, c->size);
+        c->haspend = 1;
+        pthread_cond_signal(&xu->cond);
+    }
+    xu->target = NULL;
+    pthread_mutex_unlock(&xu->mutex);
+}
@@ -0,0 +1,24 @@
+#ifndef __UVC_XU_H__
+#define __UVC_XU_H__
+
+#include <stdint.h>
+#include "linux/uvc.h"
+
+// vendor extension unit controls, handlers run on worker threads of their own so a
+// slow one never holds up the event thread, GET_CUR is answered from a cache that
+// every finished set or get leaves behind
+struct uvc_xu;
+
+typedef int (*uvc_xu_get_fn)(void *priv, int unit, int cs, uint8_t *data, int size);
+typedef int (*uvc_xu_set_fn)(void *priv, int unit, int cs, const uint8_t *data, int size);
+
+struct uvc_xu* uvc_xu_create (int nworkers);
+void           uvc_xu_destroy(struct uvc_xu *xu);
+int            uvc_xu_add    (struct uvc_xu *xu, int unit, int cs, int size, uvc_xu_get_fn get, uvc_xu_set_fn set, void *priv);
+
+// a class request on the control interface, returns 1 if the request was answered
+// here, a SET_CUR answered with a length expects its data stage through uvc_xu_data()
+int            uvc_xu_setup  (struct uvc_xu *xu, int unit, int req, int cs, struct uvc_request_data *resp);
+void           uvc_xu_data   (struct uvc_xu *xu, const struct uvc_request_data *data);
+
+#endif